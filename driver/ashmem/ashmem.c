@@ -30,7 +30,10 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
 #include <linux/shmem_fs.h>
+#include <linux/huge_mm.h>
+#include <linux/version.h>
 #include "ashmem.h"
 
 #define ASHMEM_NAME_PREFIX "dev/ashmem/"
@@ -44,9 +47,11 @@
  * @file:		The shmem-based backing file
  * @size:		The size of the mapping, in bytes
  * @prot_masks:		The allowed protection bits, as vm_flags
+ * @huge:		Whether the area asked for huge page backing
+ * @mutex:		Protects all of the above and the area's ranges
  *
  * The lifecycle of this structure is from our parent file's open() until
- * its release(). It is also protected by 'ashmem_mutex'
+ * its release(). It is protected by its own 'mutex'
  *
  * Warning: Mappings do NOT pin this structure; It dies on close()
  */
@@ -56,6 +61,8 @@ struct ashmem_area {
 	struct file *file;
 	size_t size;
 	unsigned long prot_mask;
+	bool huge;
+	struct mutex mutex;
 };
 
 /**
@@ -68,7 +75,8 @@ struct ashmem_area {
  * @purged:	         The purge status (ASHMEM_NOT or ASHMEM_WAS_PURGED)
  *
  * The lifecycle of this structure is from unpin to pin.
- * It is protected by 'ashmem_mutex'
+ * It is protected by its area's mutex; @lru is also protected by
+ * 'ashmem_lru_lock'
  */
 struct ashmem_range {
 	struct list_head lru;
@@ -79,20 +87,34 @@ struct ashmem_range {
 	unsigned int purged;
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
+/* LRU list of unpinned pages, protected by ashmem_lru_lock */
 static LIST_HEAD(ashmem_lru_list);
 
 /**
  * long lru_count - The count of pages on our LRU list.
  *
- * This is protected by ashmem_mutex.
+ * This is protected by ashmem_lru_lock.
  */
 static unsigned long lru_count;
 
 /**
- * ashmem_mutex - protects the list of and each individual ashmem_area
+ * ashmem_lru_lock - protects ashmem_lru_list and lru_count
  *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
+ * Each ashmem_area has its own mutex, so pinning, unpinning, reading and
+ * mapping different areas never contend; only the LRU is shared.
+ *
+ * Lock Ordering: ashmem_mutex -> asma->mutex -> ashmem_lru_lock
+ *                asma->mutex -> i_mutex -> i_alloc_sem
+ *
+ * The shrinker walks the LRU first and so only ever trylocks an area.
+ */
+static DEFINE_SPINLOCK(ashmem_lru_lock);
+
+/*
+ * ashmem_mutex - held by the shrinker for its whole scan, and taken by
+ * ashmem_release() before it frees an area.  An area's own mutex cannot
+ * keep the area alive: the shrinker may still be inside mutex_unlock()
+ * when ashmem_release() gets the mutex and frees it.
  */
 static DEFINE_MUTEX(ashmem_mutex);
 
@@ -123,6 +145,20 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 
 #define PROT_MASK		(PROT_EXEC | PROT_READ | PROT_WRITE)
 
+/*
+ * shmem can only be backed by huge pages from Linux 4.8 on, with
+ * CONFIG_TRANSPARENT_HUGE_PAGECACHE, which 5.8 folded into
+ * CONFIG_TRANSPARENT_HUGEPAGE.  Anywhere else ASHMEM_SET_HUGE fails
+ * with -EINVAL rather than coarsening unpins for nothing.
+ */
+#if defined(CONFIG_TRANSPARENT_HUGE_PAGECACHE) || \
+	(defined(CONFIG_TRANSPARENT_HUGEPAGE) && defined(CONFIG_SHMEM) && \
+	 LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0))
+#define HPAGE_PAGES		(HPAGE_PMD_SIZE / PAGE_SIZE)
+#else
+#define HPAGE_PAGES		1
+#endif
+
 /**
  * lru_add() - Adds a range of memory to the LRU list
  * @range:     The memory range being added.
@@ -132,8 +168,10 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
  */
 static inline void lru_add(struct ashmem_range *range)
 {
+	spin_lock(&ashmem_lru_lock);
 	list_add_tail(&range->lru, &ashmem_lru_list);
 	lru_count += range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
 /**
@@ -142,13 +180,22 @@ static inline void lru_add(struct ashmem_range *range)
  *
  * The range is first deleted from the LRU list.
  * After this, the size of the range is removed from @lru_count
+ *
+ * Caller must hold ashmem_lru_lock.
  */
-static inline void lru_del(struct ashmem_range *range)
+static inline void __lru_del(struct ashmem_range *range)
 {
 	list_del(&range->lru);
 	lru_count -= range_size(range);
 }
 
+static inline void lru_del(struct ashmem_range *range)
+{
+	spin_lock(&ashmem_lru_lock);
+	__lru_del(range);
+	spin_unlock(&ashmem_lru_lock);
+}
+
 /**
  * range_alloc() - Allocates and initializes a new ashmem_range structure
  * @asma:	   The associated ashmem_area
@@ -157,7 +204,7 @@ static inline void lru_del(struct ashmem_range *range)
  * @start:	   The starting page (inclusive)
  * @end:	   The ending page (inclusive)
  *
- * This function is protected by ashmem_mutex.
+ * Caller must hold asma->mutex.
  *
  * Return: 0 if successful, or -ENOMEM if there is an error
  */
@@ -213,11 +260,14 @@ static inline void range_shrink(struct ashmem_range *range,
 {
 	size_t pre = range_size(range);
 
+	/* lru_count is read by the shrinker, so resize under its lock */
+	spin_lock(&ashmem_lru_lock);
 	range->pgstart = start;
 	range->pgend = end;
 
 	if (range_on_lru(range))
 		lru_count -= pre - range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
 /**
@@ -244,6 +294,7 @@ static int ashmem_open(struct inode *inode, struct file *file)
 		return -ENOMEM;
 
 	INIT_LIST_HEAD(&asma->unpinned_list);
+	mutex_init(&asma->mutex);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -264,9 +315,16 @@ static int ashmem_release(struct inode *ignored, struct file *file)
 	struct ashmem_area *asma = file->private_data;
 	struct ashmem_range *range, *next;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
 		range_del(range);
+	mutex_unlock(&asma->mutex);
+
+	/*
+	 * No range of ours is on the LRU now, but the shrinker may still be
+	 * done with one it took before; it holds ashmem_mutex until then.
+	 */
+	mutex_lock(&ashmem_mutex);
 	mutex_unlock(&ashmem_mutex);
 
 	if (asma->file)
@@ -291,7 +349,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* If size is not set, or set to 0, always return EOF. */
 	if (asma->size == 0)
@@ -302,7 +360,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 		goto out_unlock;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	/*
 	 * asma and asma->file are used outside the lock here.  We assume
@@ -318,7 +376,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	return ret;
 
 out_unlock:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -327,7 +385,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -347,7 +405,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -358,12 +416,41 @@ static inline vm_flags_t calc_vm_may_flags(unsigned long prot)
 	       _calc_vm_trans(prot, PROT_EXEC,  VM_MAYEXEC);
 }
 
+/*
+ * ashmem_get_unmapped_area - place mappings of huge areas on a huge page
+ * boundary, so that every aligned huge page of the area can be mapped by
+ * a single PMD.  Other mappings are placed as usual.
+ */
+static unsigned long
+ashmem_get_unmapped_area(struct file *file, unsigned long addr,
+			 unsigned long len, unsigned long pgoff,
+			 unsigned long flags)
+{
+	struct ashmem_area *asma = file->private_data;
+	unsigned long (*get_area)(struct file *, unsigned long, unsigned long,
+				  unsigned long, unsigned long);
+	unsigned long off, ret;
+
+	get_area = current->mm->get_unmapped_area;
+	if (HPAGE_PAGES == 1 || !asma->huge || (flags & MAP_FIXED) ||
+	    len < HPAGE_PAGES * PAGE_SIZE)
+		return get_area(file, addr, len, pgoff, flags);
+
+	/* Ask for one huge page more than needed and align within it */
+	ret = get_area(file, 0, len + HPAGE_PAGES * PAGE_SIZE, pgoff, flags);
+	if (IS_ERR_VALUE(ret))
+		return ret;
+	off = (pgoff << PAGE_SHIFT) & (HPAGE_PAGES * PAGE_SIZE - 1);
+	ret += (off - ret) & (HPAGE_PAGES * PAGE_SIZE - 1);
+	return ret;
+}
+
 static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 {
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* user needs to SET_SIZE before mapping */
 	if (unlikely(!asma->size)) {
@@ -412,8 +499,16 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 		fput(vma->vm_file);
 	vma->vm_file = asma->file;
 
+	/*
+	 * Let shmem back the mapping with transparent huge pages.  This
+	 * is what madvise(MADV_HUGEPAGE) would do, and like it only has
+	 * an effect when the shmem_enabled policy allows it.
+	 */
+	if (asma->huge)
+		vma->vm_flags |= VM_HUGEPAGE;
+
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -430,32 +525,61 @@ out:
  * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
  * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
  * pages freed.
+ *
+ * Areas are only trylocked: one that is busy pinning, unpinning or being
+ * mapped is skipped rather than waited for, and we cannot deadlock against
+ * a task that is allocating memory with its area's mutex held.  A range
+ * is taken off the LRU before its pages are punched out, so the LRU lock
+ * is not held across vfs_fallocate().  ashmem_mutex is held throughout so
+ * that no area is freed under us; it is only trylocked too, as punching
+ * pages out may itself recurse into reclaim.
  */
 static unsigned long
 ashmem_shrink_scan(struct shrinker *shrink, struct shrink_control *sc)
 {
-	struct ashmem_range *range, *next;
+	struct ashmem_range *range;
 	unsigned long freed = 0;
 
 	/* We might recurse into filesystem code, so bail out if necessary */
 	if (!(sc->gfp_mask & __GFP_FS))
 		return SHRINK_STOP;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE;
+	if (!mutex_trylock(&ashmem_mutex))
+		return SHRINK_STOP;
+
+	spin_lock(&ashmem_lru_lock);
+restart:
+	list_for_each_entry(range, &ashmem_lru_list, lru) {
+		struct ashmem_area *asma = range->asma;
+		loff_t start, end;
 
-		vfs_fallocate(range->asma->file,
+		/*
+		 * Holding the area's mutex keeps the range from going away
+		 * once we drop the LRU lock; ashmem_mutex keeps the area.
+		 */
+		if (!mutex_trylock(&asma->mutex))
+			continue;
+
+		__lru_del(range);
+		spin_unlock(&ashmem_lru_lock);
+
+		start = range->pgstart * PAGE_SIZE;
+		end = (range->pgend + 1) * PAGE_SIZE;
+		vfs_fallocate(asma->file,
 			      FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
 			      start, end - start);
 		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
-
 		freed += range_size(range);
+		mutex_unlock(&asma->mutex);
+
 		if (--sc->nr_to_scan <= 0)
-			break;
+			goto out;
+
+		spin_lock(&ashmem_lru_lock);
+		goto restart;
 	}
+	spin_unlock(&ashmem_lru_lock);
+out:
 	mutex_unlock(&ashmem_mutex);
 	return freed;
 }
@@ -485,7 +609,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* the user can only remove, not add, protection bits */
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -500,7 +624,24 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
+	return ret;
+}
+
+static int set_huge(struct ashmem_area *asma, unsigned long huge)
+{
+	int ret = 0;
+
+	if (HPAGE_PAGES == 1)
+		return huge ? -EINVAL : 0;
+
+	mutex_lock(&asma->mutex);
+	/* like the size, this cannot change once the area is mapped */
+	if (unlikely(asma->file))
+		ret = -EINVAL;
+	else
+		asma->huge = !!huge;
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -511,10 +652,10 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	char local_name[ASHMEM_NAME_LEN];
 
 	/*
-	 * Holding the ashmem_mutex while doing a copy_from_user might cause
+	 * Holding the area's mutex while doing a copy_from_user might cause
 	 * an data abort which would try to access mmap_sem. If another
 	 * thread has invoked ashmem_mmap then it will be holding the
-	 * semaphore and will be waiting for ashmem_mutex, there by leading to
+	 * semaphore and will be waiting for the mutex, there by leading to
 	 * deadlock. We'll release the mutex  and take the name to a local
 	 * variable that does not need protection and later copy the local
 	 * variable to the structure member with lock held.
@@ -524,14 +665,14 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 		return len;
 	if (len == ASHMEM_NAME_LEN)
 		local_name[ASHMEM_NAME_LEN - 1] = '\0';
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	/* cannot change an existing mapping's name */
 	if (unlikely(asma->file))
 		ret = -EINVAL;
 	else
 		strcpy(asma->name + ASHMEM_NAME_PREFIX_LEN, local_name);
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -547,7 +688,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 	 */
 	char local_name[ASHMEM_NAME_LEN];
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		/*
 		 * Copying only `len', instead of ASHMEM_NAME_LEN, bytes
@@ -559,7 +700,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 		len = sizeof(ASHMEM_NAME_DEF);
 		memcpy(local_name, ASHMEM_NAME_DEF, len);
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	/*
 	 * Now we are just copying from the stack variable to userland
@@ -574,7 +715,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
  * ashmem_pin - pin the given ashmem region, returning whether it was
  * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED).
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
@@ -640,7 +781,7 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 /*
  * ashmem_unpin - unpin the given range of pages. Returns zero on success.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
@@ -675,7 +816,7 @@ restart:
  * ashmem_get_pin_status - Returns ASHMEM_IS_UNPINNED if _any_ pages in the
  * given interval are unpinned and ASHMEM_IS_PINNED otherwise.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 				 size_t pgend)
@@ -724,7 +865,31 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
+
+	/*
+	 * A huge area is only ever unpinned, and so purged, in whole huge
+	 * pages: an unpin covers just the huge pages it fully contains and
+	 * a pin or status query covers every huge page it touches.  This
+	 * keeps a purge from splitting a huge page that is still in use.
+	 */
+	if (asma->huge) {
+		size_t last = PAGE_ALIGN(asma->size) / PAGE_SIZE - 1;
+
+		if (cmd == ASHMEM_UNPIN) {
+			pgstart = round_up(pgstart, HPAGE_PAGES);
+			if (pgend != last)
+				pgend = round_down(pgend + 1, HPAGE_PAGES) - 1;
+			/* no whole huge page in the range, nothing to unpin */
+			if (pgend + 1 <= pgstart) {
+				ret = 0;
+				goto out_unlock;
+			}
+		} else {
+			pgstart = round_down(pgstart, HPAGE_PAGES);
+			pgend = min(round_up(pgend + 1, HPAGE_PAGES) - 1, last);
+		}
+	}
 
 	switch (cmd) {
 	case ASHMEM_PIN:
@@ -738,7 +903,8 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+out_unlock:
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
@@ -757,10 +923,12 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		break;
 	case ASHMEM_SET_SIZE:
 		ret = -EINVAL;
+		mutex_lock(&asma->mutex);
 		if (!asma->file) {
 			ret = 0;
 			asma->size = (size_t) arg;
 		}
+		mutex_unlock(&asma->mutex);
 		break;
 	case ASHMEM_GET_SIZE:
 		ret = asma->size;
@@ -771,6 +939,12 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case ASHMEM_GET_PROT_MASK:
 		ret = asma->prot_mask;
 		break;
+	case ASHMEM_SET_HUGE:
+		ret = set_huge(asma, arg);
+		break;
+	case ASHMEM_GET_HUGE:
+		ret = asma->huge;
+		break;
 	case ASHMEM_PIN:
 	case ASHMEM_UNPIN:
 	case ASHMEM_GET_PIN_STATUS:
@@ -816,6 +990,7 @@ static const struct file_operations ashmem_fops = {
 	.read = ashmem_read,
 	.llseek = ashmem_llseek,
 	.mmap = ashmem_mmap,
+	.get_unmapped_area = ashmem_get_unmapped_area,
 	.unlocked_ioctl = ashmem_ioctl,
 #ifdef CONFIG_COMPAT
 	.compat_ioctl = compat_ashmem_ioctl,
@@ -104,6 +104,7 @@ struct binder_version {
 #define BINDER_SET_CONTEXT_MGR		_IOW('b', 7, __s32)
 #define BINDER_THREAD_EXIT		_IOW('b', 8, __s32)
 #define BINDER_VERSION			_IOWR('b', 9, struct binder_version)
+#define BINDER_SET_EXCLUSIVE_POLL	_IOW('b', 10, __s32)
 
 /*
  * NOTE: Two special error codes you should check for when calling
@@ -125,8 +126,15 @@ enum transaction_flags {
 	TF_ROOT_OBJECT	= 0x04,	/* contents are the component's root object */
 	TF_STATUS_CODE	= 0x08,	/* contents are a 32-bit status code */
 	TF_ACCEPT_FDS	= 0x10,	/* allow replies with file descriptors */
+	TF_NICE_VALID	= 0x20,	/* brTRANSACTION: TF_NICE_MASK holds the */
+				/* receiving thread's nice value + 20 */
+	TF_COMPACT_TOKENS = 0x40, /* reply: the replier accepts compact */
+				/* interface tokens (libbinder Parcel) */
 };
 
+#define TF_NICE_SHIFT	24
+#define TF_NICE_MASK	(0xffU << TF_NICE_SHIFT)
+
 struct binder_transaction_data {
 	/* The first two are only used for bcTRANSACTION and brTRANSACTION,
 	 * identifying the target and contents of the transaction.
@@ -269,6 +277,13 @@ enum binder_driver_return_protocol {
 	 * The the last transaction (either a bcTRANSACTION or
 	 * a bcATTEMPT_ACQUIRE) failed (e.g. out of memory).  No parameters.
 	 */
+
+	BR_BUFFER_LIMIT_REPLY = _IO('r', 18),
+	/*
+	 * The last transaction failed because the target process has used
+	 * up its buffer page limit, or its memory cgroup could not be
+	 * charged for the buffer.  No parameters.
+	 */
 };
 
 enum binder_driver_command_protocol {
@@ -5,6 +5,7 @@
 #include <linux/mm.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
+#include <linux/memcontrol.h>
 
 #include "deps.h"
 
@@ -23,6 +24,12 @@ static int (*security_binder_set_context_mgr_ptr)(struct task_struct *mgr) = SEC
 static int (*security_binder_transaction_ptr)(struct task_struct *from, struct task_struct *to) = SECURITY_BINDER_TRANSACTION;
 static int (*security_binder_transfer_binder_ptr)(struct task_struct *from, struct task_struct *to) = SECURITY_BINDER_TRANSFER_BINDER;
 static int (*security_binder_transfer_file_ptr)(struct task_struct *from, struct task_struct *to, struct file *file) = SECURITY_BINDER_TRANSFER_FILE;
+#ifdef CONFIG_MEMCG_KMEM
+static struct mem_cgroup *(*mem_cgroup_from_task_ptr)(struct task_struct *p) = MEM_CGROUP_FROM_TASK;
+static struct cgroup_subsys_state *(*mem_cgroup_css_ptr)(struct mem_cgroup *memcg) = MEM_CGROUP_CSS;
+static int (*memcg_charge_kmem_ptr)(struct mem_cgroup *memcg, gfp_t gfp, unsigned long nr_pages) = MEMCG_CHARGE_KMEM;
+static void (*memcg_uncharge_kmem_ptr)(struct mem_cgroup *memcg, unsigned long nr_pages) = MEMCG_UNCHARGE_KMEM;
+#endif
 
 struct vm_struct *get_vm_area(unsigned long size, unsigned long flags)
 {
@@ -98,3 +105,25 @@ int security_binder_transfer_file(struct task_struct *from, struct task_struct *
 {
 	return security_binder_transfer_file_ptr(from, to, file);
 }
+
+#ifdef CONFIG_MEMCG_KMEM
+struct mem_cgroup *mem_cgroup_from_task(struct task_struct *p)
+{
+	return mem_cgroup_from_task_ptr(p);
+}
+
+struct cgroup_subsys_state *mem_cgroup_css(struct mem_cgroup *memcg)
+{
+	return mem_cgroup_css_ptr(memcg);
+}
+
+int memcg_charge_kmem(struct mem_cgroup *memcg, gfp_t gfp, unsigned long nr_pages)
+{
+	return memcg_charge_kmem_ptr(memcg, gfp, nr_pages);
+}
+
+void memcg_uncharge_kmem(struct mem_cgroup *memcg, unsigned long nr_pages)
+{
+	memcg_uncharge_kmem_ptr(memcg, nr_pages);
+}
+#endif
@@ -6,9 +6,15 @@ SYMS="get_vm_area zap_page_range map_kernel_range_noflush unmap_kernel_range "\
 "security_binder_set_context_mgr security_binder_transaction "\
 "security_binder_transfer_binder security_binder_transfer_file"
 
-for sym in $SYMS; do 
+# Only present, and only used, with CONFIG_MEMCG_KMEM
+OPT_SYMS="mem_cgroup_from_task mem_cgroup_css memcg_charge_kmem memcg_uncharge_kmem"
+
+for sym in $SYMS $OPT_SYMS; do 
 	addr=`cat /proc/kallsyms | grep -Ee '^[0-9a-f]+ T '$sym'$' | sed -e 's/\s.*$//g'`
 	if [ a$addr = 'a' ]; then
+		case " $OPT_SYMS " in
+		*" $sym "*) continue ;;
+		esac
 		echo "Error: can't find symbol $sym"
 		exit 1
 	fi
@@ -73,6 +73,7 @@ public:
 BBinder::BBinder()
 {
   atomic_init(&mExtras, static_cast<uintptr_t>(0));
+  atomic_init(&mAsyncCalls, false);
 }
 
 bool BBinder::isBinderAlive() const
@@ -104,6 +105,27 @@ status_t BBinder::transact(
         case PING_TRANSACTION:
             reply->writeInt32(pingBinder());
             break;
+        case ASYNC_CALL_TRANSACTION: {
+            // Sent by BpBinder::transactAsync(): run the call it carries
+            // and send its reply back, as a oneway call of its own, to the
+            // reply binder made for this call.
+            if (!asyncCallsEnabled()) {
+                err = onTransact(code, data, reply, flags);
+                break;
+            }
+            sp<IBinder> replyTo = data.readStrongBinder();
+            const uint32_t callCode = data.readInt32();
+            if (replyTo == NULL) {
+                err = BAD_VALUE;
+                break;
+            }
+            Parcel callReply;
+            const status_t callErr = onTransact(callCode, data, &callReply, 0);
+            Parcel out;
+            out.writeInt32(callErr);
+            out.appendFrom(&callReply, 0, callReply.dataSize());
+            err = replyTo->transact(FIRST_CALL_TRANSACTION, out, NULL, FLAG_ONEWAY);
+        } break;
         default:
             err = onTransact(code, data, reply, flags);
             break;
@@ -193,6 +215,16 @@ BBinder* BBinder::localBinder()
     return this;
 }
 
+void BBinder::setAsyncCallsEnabled(bool enabled)
+{
+    mAsyncCalls.store(enabled, std::memory_order_relaxed);
+}
+
+bool BBinder::asyncCallsEnabled() const
+{
+    return mAsyncCalls.load(std::memory_order_relaxed);
+}
+
 BBinder::~BBinder()
 {
     Extras* e = reinterpret_cast<Extras*>(
@@ -259,6 +291,14 @@ BpRefBase::~BpRefBase()
     }
 }
 
+void BpRefBase::reserveRequest(uint32_t code, Parcel* data) const
+{
+    BpBinder* proxy = mRemote != NULL ? mRemote->remoteBinder() : NULL;
+    if (proxy != NULL) {
+        proxy->reserveRequest(code, data);
+    }
+}
+
 void BpRefBase::onFirstRef()
 {
     android_atomic_or(kRemoteAcquired, &mState);
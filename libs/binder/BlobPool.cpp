@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "BlobPool"
+
+#include <binder/BlobPool.h>
+
+#include <utils/Log.h>
+
+#include <stdint.h>
+#include <unistd.h>
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+// Pool heaps a reader keeps mapped, most recently used first.
+static const size_t kMappedHeaps = 4;
+
+static Mutex gMappedHeapsLock;
+static Vector< sp<IMemoryHeap> > gMappedHeaps;
+
+static inline uint32_t* busy_word(uint8_t* base)
+{
+    return reinterpret_cast<uint32_t*>(base);
+}
+
+// ----------------------------------------------------------------------------
+
+BlobPool::BlobPool(size_t size, const char* name)
+    : mDealer(new MemoryDealer(size, name))
+    , mNextTicket(1)
+{
+}
+
+BlobPool::~BlobPool()
+{
+}
+
+void* BlobPool::acquire(size_t len, size_t* outOffset, uint32_t* outTicket)
+{
+    const size_t pagesize = getpagesize();
+    const size_t need = (HEADER_SIZE + len + pagesize - 1) & ~(pagesize - 1);
+
+    Mutex::Autolock _l(mLock);
+    reclaim();
+
+    // Best fit among the chunks readers are done with.
+    ssize_t best = -1;
+    for (size_t i = 0; i < mFree.size(); i++) {
+        const size_t size = mFree[i].size;
+        if (size >= need && (best < 0 || size < mFree[best].size)) {
+            best = i;
+        }
+    }
+
+    chunk_t chunk;
+    if (best >= 0) {
+        chunk = mFree[best];
+        mFree.removeAt(best);
+    } else {
+        sp<IMemory> memory = mDealer->allocate(need);
+        if (memory == NULL && !mFree.isEmpty()) {
+            // None fits: give the idle chunks back to the dealer and retry.
+            mFree.clear();
+            memory = mDealer->allocate(need);
+        }
+        if (memory == NULL) {
+            return NULL;
+        }
+        chunk.memory = memory;
+        chunk.base = static_cast<uint8_t*>(memory->pointer());
+        chunk.size = need;
+    }
+
+    const uint32_t ticket = mNextTicket++;
+    if (mNextTicket == 0) mNextTicket = 1;
+    __atomic_store_n(busy_word(chunk.base), ticket, __ATOMIC_RELAXED);
+    mBusy.add(chunk);
+    *outOffset = chunk.memory->offset() + HEADER_SIZE;
+    *outTicket = ticket;
+    return chunk.base + HEADER_SIZE;
+}
+
+void BlobPool::reclaim()
+{
+    for (size_t i = mBusy.size(); i > 0; i--) {
+        const chunk_t& chunk = mBusy[i - 1];
+        if (__atomic_load_n(busy_word(chunk.base), __ATOMIC_ACQUIRE) == 0) {
+            mFree.add(chunk);
+            mBusy.removeAt(i - 1);
+        }
+    }
+}
+
+sp<IMemoryHeap> BlobPool::heap() const
+{
+    return mDealer->getMemoryHeap();
+}
+
+size_t BlobPool::busyCount() const
+{
+    Mutex::Autolock _l(mLock);
+    const_cast<BlobPool*>(this)->reclaim();
+    return mBusy.size();
+}
+
+sp<IMemoryHeap> BlobPool::mapHeap(const sp<IBinder>& binder)
+{
+    if (binder->localBinder() != NULL) {
+        return findHeap(binder);
+    }
+
+    Mutex::Autolock _l(gMappedHeapsLock);
+    for (size_t i = 0; i < gMappedHeaps.size(); i++) {
+        if (IInterface::asBinder(gMappedHeaps[i]) == binder) {
+            sp<IMemoryHeap> heap = gMappedHeaps[i];
+            if (i > 0) {
+                gMappedHeaps.removeAt(i);
+                gMappedHeaps.insertAt(heap, 0);
+            }
+            return heap;
+        }
+    }
+
+    sp<IMemoryHeap> heap = interface_cast<IMemoryHeap>(binder);
+    if (heap == NULL || heap->getBase() == MAP_FAILED) {
+        ALOGE("cannot map blob pool heap (binder=%p)", binder.get());
+        return NULL;
+    }
+    gMappedHeaps.insertAt(heap, 0);
+    if (gMappedHeaps.size() > kMappedHeaps) {
+        gMappedHeaps.removeAt(kMappedHeaps);
+    }
+    return heap;
+}
+
+sp<IMemoryHeap> BlobPool::findHeap(const sp<IBinder>& binder)
+{
+    // A pool of this process, as in a parcel that was never sent
+    if (binder->localBinder() != NULL) {
+        return static_cast<IMemoryHeap*>(
+                binder->queryLocalInterface(IMemoryHeap::descriptor).get());
+    }
+
+    Mutex::Autolock _l(gMappedHeapsLock);
+    for (size_t i = 0; i < gMappedHeaps.size(); i++) {
+        if (IInterface::asBinder(gMappedHeaps[i]) == binder) {
+            return gMappedHeaps[i];
+        }
+    }
+    return NULL;
+}
+
+void BlobPool::release(void* data, uint32_t ticket)
+{
+    uint8_t* base = static_cast<uint8_t*>(data) - HEADER_SIZE;
+    __atomic_compare_exchange_n(busy_word(base), &ticket, 0, false,
+            __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
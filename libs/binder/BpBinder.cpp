@@ -19,9 +19,12 @@
 
 #include <binder/BpBinder.h>
 
+#include <binder/BlobPool.h>
+#include <binder/Binder.h>
 #include <binder/IPCThreadState.h>
 #include <utils/Log.h>
 
+#include <inttypes.h>
 #include <stdio.h>
 
 //#undef ALOGV
@@ -91,9 +94,16 @@ BpBinder::BpBinder(int32_t handle)
     , mAlive(1)
     , mObitsSent(0)
     , mObituaries(NULL)
+    , mSizePrediction(false)
+    , mAsyncLinked(false)
+    , mCompactTokens(false)
 {
     ALOGV("Creating BpBinder %p handle %d\n", this, mHandle);
 
+    for (size_t i = 0; i < SIZE_HINTS; i++) {
+        mSizeHints[i].store(0, std::memory_order_relaxed);
+    }
+
     extendObjectLifetime(OBJECT_LIFETIME_WEAK);
     IPCThreadState::self()->incWeakHandle(handle);
 }
@@ -161,15 +171,187 @@ status_t BpBinder::transact(
 {
     // Once a binder has died, it will never come back to life.
     if (mAlive) {
-        status_t status = IPCThreadState::self()->transact(
-            mHandle, code, data, reply, flags);
+        if (mSizePrediction.load(std::memory_order_relaxed)) {
+            const size_t size = data.dataSize();
+            mSizeHints[code % SIZE_HINTS].store(((uint64_t)code << 32)
+                    | (size > UINT32_MAX ? UINT32_MAX : size),
+                    std::memory_order_relaxed);
+        }
+        IPCThreadState* ipc = IPCThreadState::self();
+        status_t status = ipc->transact(mHandle, code, data, reply, flags);
         if (status == DEAD_OBJECT) mAlive = 0;
+        if ((ipc->getLastReplyFlags() & TF_COMPACT_TOKENS) != 0
+                && !mCompactTokens.load(std::memory_order_relaxed)) {
+            mCompactTokens.store(true, std::memory_order_relaxed);
+        }
         return status;
     }
 
     return DEAD_OBJECT;
 }
 
+void BpBinder::setSizePrediction(bool enabled)
+{
+    mSizePrediction.store(enabled, std::memory_order_relaxed);
+}
+
+status_t BpBinder::reserveRequest(uint32_t code, Parcel* data) const
+{
+    const uint64_t hint = mSizeHints[code % SIZE_HINTS].load(std::memory_order_relaxed);
+    if ((uint32_t)(hint >> 32) != code) return NO_ERROR;
+    return data->reserve((uint32_t)hint);
+}
+
+sp<BlobPool> BpBinder::getBlobPool(size_t size)
+{
+    AutoMutex _l(mLock);
+    if (mBlobPool == NULL) {
+        mBlobPool = new BlobPool(size, "BpBinder blob pool");
+    }
+    return mBlobPool;
+}
+
+// ---------------------------------------------------------------------------
+
+// The pending transactAsync() calls of this process.  A target's death
+// fails its pending calls.
+class AsyncReplies : public IBinder::DeathRecipient
+{
+public:
+    AsyncReplies() : mNextId(1) { }
+
+    uint64_t add(const IBinder* target, const BpBinder::AsyncReplyFunc& done)
+    {
+        AutoMutex _l(mLock);
+        const uint64_t id = mNextId++;
+        pending_t call;
+        call.target = target;
+        call.done = done;
+        mPending.add(id, call);
+        return id;
+    }
+
+    bool remove(uint64_t id, BpBinder::AsyncReplyFunc* outDone)
+    {
+        AutoMutex _l(mLock);
+        const ssize_t i = mPending.indexOfKey(id);
+        if (i < 0) return false;
+        *outDone = mPending.valueAt(i).done;
+        mPending.removeItemsAt(i);
+        return true;
+    }
+
+    virtual void binderDied(const wp<IBinder>& who)
+    {
+        Vector<BpBinder::AsyncReplyFunc> failed;
+        {
+            AutoMutex _l(mLock);
+            for (size_t i = mPending.size(); i > 0; i--) {
+                if (mPending.valueAt(i - 1).target == who.unsafe_get()) {
+                    failed.push(mPending.valueAt(i - 1).done);
+                    mPending.removeItemsAt(i - 1);
+                }
+            }
+        }
+        Parcel empty;
+        for (size_t i = 0; i < failed.size(); i++) {
+            failed[i](DEAD_OBJECT, empty);
+        }
+    }
+
+private:
+    struct pending_t {
+        const IBinder* target;
+        BpBinder::AsyncReplyFunc done;
+    };
+
+    Mutex mLock;
+    uint64_t mNextId;
+    KeyedVector<uint64_t, pending_t> mPending;
+};
+
+static const sp<AsyncReplies>& async_replies()
+{
+    static sp<AsyncReplies> replies = new AsyncReplies();
+    return replies;
+}
+
+// The reply binder of one transactAsync() call.  It only goes to the
+// call's target, so no other process can complete the call.
+class AsyncReply : public BBinder
+{
+public:
+    explicit AsyncReply(uint64_t id) : mId(id) { }
+
+protected:
+    virtual status_t onTransact(uint32_t code, const Parcel& data,
+                                Parcel* reply, uint32_t flags)
+    {
+        if (code != FIRST_CALL_TRANSACTION) {
+            return BBinder::onTransact(code, data, reply, flags);
+        }
+        const status_t status = data.readInt32();
+        BpBinder::AsyncReplyFunc done;
+        if (!async_replies()->remove(mId, &done)) {
+            ALOGW("reply to finished async call %" PRIu64, mId);
+            return BAD_VALUE;
+        }
+        done(status, data);
+        return NO_ERROR;
+    }
+
+private:
+    const uint64_t mId;
+};
+
+status_t BpBinder::transactAsync(uint32_t code, const Parcel& data,
+                                 const AsyncReplyFunc& done)
+{
+    const sp<AsyncReplies>& replies = async_replies();
+    if (!mAsyncLinked.exchange(true)) {
+        status_t err = linkToDeath(replies);
+        if (err != NO_ERROR) {
+            mAsyncLinked.store(false);
+            return err;
+        }
+    }
+
+    const uint64_t id = replies->add(this, done);
+    Parcel request;
+    request.writeStrongBinder(new AsyncReply(id));
+    request.writeInt32(code);
+    status_t err = request.appendFrom(&data, 0, data.dataSize());
+    if (err == NO_ERROR) {
+        err = transact(ASYNC_CALL_TRANSACTION, request, NULL, FLAG_ONEWAY);
+    }
+    if (err != NO_ERROR) {
+        // A death notice read while sending may already have failed the
+        // call through done; then it must not be failed a second time.
+        AsyncReplyFunc unused;
+        if (!replies->remove(id, &unused)) return NO_ERROR;
+    }
+    return err;
+}
+
+std::future<status_t> BpBinder::transactAsync(uint32_t code, const Parcel& data,
+                                              Parcel* reply)
+{
+    std::shared_ptr<std::promise<status_t> > promise =
+            std::make_shared<std::promise<status_t> >();
+    std::future<status_t> result = promise->get_future();
+
+    status_t err = transactAsync(code, data,
+            [promise, reply](status_t status, const Parcel& r) {
+                reply->appendFrom(&r, r.dataPosition(), r.dataAvail());
+                reply->setDataPosition(0);
+                promise->set_value(status);
+            });
+    if (err != NO_ERROR) {
+        promise->set_value(err);
+    }
+    return result;
+}
+
 status_t BpBinder::linkToDeath(
     const sp<DeathRecipient>& recipient, void* cookie, uint32_t flags)
 {
@@ -21,6 +21,7 @@
 #include <binder/Binder.h>
 #include <binder/BpBinder.h>
 #include <binder/TextOutput.h>
+#include <binder/TransactionExecutor.h>
 
 #include <cutils/sched_policy.h>
 #include <utils/Log.h>
@@ -34,6 +35,7 @@
 #include <sched.h>
 #include <signal.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/resource.h>
@@ -90,7 +92,8 @@ static const char *kReturnStrings[] = {
     "BR_FINISHED",
     "BR_DEAD_BINDER",
     "BR_CLEAR_DEATH_NOTIFICATION_DONE",
-    "BR_FAILED_REPLY"
+    "BR_FAILED_REPLY",
+    "BR_BUFFER_LIMIT_REPLY"
 };
 
 static const char *kCommandStrings[] = {
@@ -281,38 +284,37 @@ static pthread_key_t gTLS = 0;
 static bool gShutdown = false;
 static bool gDisableBackgroundScheduling = false;
 
-IPCThreadState* IPCThreadState::self()
+// The read buffer starts small and doubles, up to kMaxInCapacity, each time
+// the driver fills it, so a thread with a backlog of commands picks up
+// more of them per BINDER_WRITE_READ.
+static const size_t kInitialInCapacity = 256;
+static const size_t kMaxInCapacity = 4096;
+
+thread_local IPCThreadState* IPCThreadState::sSelf = NULL;
+
+// First use on this thread: make sure the key that destroys the state
+// at thread exit exists, then create it.
+IPCThreadState* IPCThreadState::selfSlow()
 {
-    if (gHaveTLS) {
-restart:
-        const pthread_key_t k = gTLS;
-        IPCThreadState* st = (IPCThreadState*)pthread_getspecific(k);
-        if (st) return st;
-        return new IPCThreadState;
-    }
-    
-    if (gShutdown) return NULL;
-    
-    pthread_mutex_lock(&gTLSMutex);
     if (!gHaveTLS) {
-        if (pthread_key_create(&gTLS, threadDestructor) != 0) {
-            pthread_mutex_unlock(&gTLSMutex);
-            return NULL;
+        if (gShutdown) return NULL;
+
+        pthread_mutex_lock(&gTLSMutex);
+        if (!gHaveTLS) {
+            if (pthread_key_create(&gTLS, threadDestructor) != 0) {
+                pthread_mutex_unlock(&gTLSMutex);
+                return NULL;
+            }
+            gHaveTLS = true;
         }
-        gHaveTLS = true;
+        pthread_mutex_unlock(&gTLSMutex);
     }
-    pthread_mutex_unlock(&gTLSMutex);
-    goto restart;
+    return new IPCThreadState;
 }
 
 IPCThreadState* IPCThreadState::selfOrNull()
 {
-    if (gHaveTLS) {
-        const pthread_key_t k = gTLS;
-        IPCThreadState* st = (IPCThreadState*)pthread_getspecific(k);
-        return st;
-    }
-    return NULL;
+    return sSelf;
 }
 
 void IPCThreadState::shutdown()
@@ -321,7 +323,7 @@ void IPCThreadState::shutdown()
     
     if (gHaveTLS) {
         // XXX Need to wait for all thread pool threads to exit!
-        IPCThreadState* st = (IPCThreadState*)pthread_getspecific(gTLS);
+        IPCThreadState* st = sSelf;
         if (st) {
             delete st;
             pthread_setspecific(gTLS, NULL);
@@ -390,6 +392,11 @@ void IPCThreadState::restoreCallingIdentity(int64_t token)
     mCallingPid = (int)token;
 }
 
+void IPCThreadState::resetDriverStats()
+{
+    memset(&mDriverStats, 0, sizeof(mDriverStats));
+}
+
 void IPCThreadState::clearCaller()
 {
     mCallingPid = getpid();
@@ -425,6 +432,7 @@ status_t IPCThreadState::getAndExecuteCommand()
         size_t IN = mIn.dataAvail();
         if (IN < sizeof(int32_t)) return result;
         cmd = mIn.readInt32();
+        mDriverStats.commandsIn++;
         IF_LOG_COMMANDS() {
             alog << "Processing top-level Command: "
                  << getReturnString(cmd) << endl;
@@ -444,11 +452,13 @@ status_t IPCThreadState::getAndExecuteCommand()
         // After executing the command, ensure that the thread is returned to the
         // foreground cgroup before rejoining the pool.  The driver takes care of
         // restoring the priority, but doesn't do anything with cgroups so we
-        // need to take care of that here in userspace.  Note that we do make
-        // sure to go in the foreground after executing a transaction, but
-        // there are other callbacks into user code that could have changed
-        // our group so we want to make absolutely sure it is put back.
-        set_sched_policy(mMyThreadId, SP_FOREGROUND);
+        // need to take care of that here in userspace.  Only the group we put
+        // the thread in is tracked, so code that moves a binder thread to
+        // another group some other way must put it back itself.
+        if (mSchedPolicy != SP_FOREGROUND) {
+            set_sched_policy(mMyThreadId, SP_FOREGROUND);
+            mSchedPolicy = SP_FOREGROUND;
+        }
     }
 
     return result;
@@ -488,6 +498,7 @@ void IPCThreadState::joinThreadPool(bool isMain)
     // scheduling group, so first we will make sure it is in the foreground
     // one to avoid performing an initial transaction in the background.
     set_sched_policy(mMyThreadId, SP_FOREGROUND);
+    mSchedPolicy = SP_FOREGROUND;
         
     status_t result;
     do {
@@ -515,12 +526,22 @@ void IPCThreadState::joinThreadPool(bool isMain)
     talkWithDriver(false);
 }
 
-int IPCThreadState::setupPolling(int* fd)
+int IPCThreadState::setupPolling(int* fd, bool exclusive)
 {
     if (mProcess->mDriverFD <= 0) {
         return -EBADF;
     }
 
+    if (exclusive) {
+        int enable = 1;
+        if (ioctl(mProcess->mDriverFD, BINDER_SET_EXCLUSIVE_POLL, &enable) == -1) {
+            int result = -errno;
+            ALOGE("Binder ioctl to enable exclusive polling failed: %s", strerror(-result));
+            return result;
+        }
+    }
+
+    mExclusivePoll = exclusive;
     mOut.writeInt32(BC_ENTER_LOOPER);
     *fd = mProcess->mDriverFD;
     return 0;
@@ -530,9 +551,18 @@ status_t IPCThreadState::handlePolledCommands()
 {
     status_t result;
 
+    // A plain poller would block once the driver runs dry, so it only
+    // handles what the wakeup brought in.  An exclusive poller never blocks
+    // waiting for process work and drains it all; -EAGAIN then means done,
+    // or that another thread got to the work first.
     do {
         result = getAndExecuteCommand();
-    } while (mIn.dataPosition() < mIn.dataSize());
+    } while (mIn.dataPosition() < mIn.dataSize()
+             || (mExclusivePoll && result == NO_ERROR));
+
+    if (result == -EAGAIN) {
+        result = NO_ERROR;
+    }
 
     processPendingDerefs();
     flushCommands();
@@ -556,6 +586,7 @@ status_t IPCThreadState::transact(int32_t handle,
     status_t err = data.errorCheck();
 
     flags |= TF_ACCEPT_FDS;
+    mLastReplyFlags = 0;
 
     IF_LOG_TRANSACTIONS() {
         TextOutput::Bundle _b(alog);
@@ -568,9 +599,11 @@ status_t IPCThreadState::transact(int32_t handle,
         LOG_ONEWAY(">>>> SEND from pid %d uid %d %s", getpid(), getuid(),
             (flags & TF_ONE_WAY) == 0 ? "READ REPLY" : "ONE WAY");
         err = writeTransactionData(BC_TRANSACTION, flags, handle, code, data, NULL);
+        if (err == NO_ERROR) mDriverStats.transactionsOut++;
     }
     
     if (err != NO_ERROR) {
+        data.releasePoolBlobs();
         if (reply) reply->setError(err);
         return (mLastError = err);
     }
@@ -607,42 +640,93 @@ status_t IPCThreadState::transact(int32_t handle,
     } else {
         err = waitForResponse(NULL, NULL);
     }
-    
+
+    // Releasing a chunk the receiver already handed back does nothing.
+    if (err != NO_ERROR) data.releasePoolBlobs();
     return err;
 }
 
 void IPCThreadState::incStrongHandle(int32_t handle)
 {
     LOG_REMOTEREFS("IPCThreadState::incStrongHandle(%d)\n", handle);
-    mOut.writeInt32(BC_ACQUIRE);
-    mOut.writeInt32(handle);
+    addPendingRef(handle, 1, 0);
 }
 
 void IPCThreadState::decStrongHandle(int32_t handle)
 {
     LOG_REMOTEREFS("IPCThreadState::decStrongHandle(%d)\n", handle);
-    mOut.writeInt32(BC_RELEASE);
-    mOut.writeInt32(handle);
+    addPendingRef(handle, -1, 0);
 }
 
 void IPCThreadState::incWeakHandle(int32_t handle)
 {
     LOG_REMOTEREFS("IPCThreadState::incWeakHandle(%d)\n", handle);
-    mOut.writeInt32(BC_INCREFS);
-    mOut.writeInt32(handle);
+    addPendingRef(handle, 0, 1);
 }
 
 void IPCThreadState::decWeakHandle(int32_t handle)
 {
     LOG_REMOTEREFS("IPCThreadState::decWeakHandle(%d)\n", handle);
-    mOut.writeInt32(BC_DECREFS);
-    mOut.writeInt32(handle);
+    addPendingRef(handle, 0, -1);
+}
+
+void IPCThreadState::addPendingRef(int32_t handle, int32_t strong, int32_t weak)
+{
+    for (size_t i = 0; i < mPendingRefCount; i++) {
+        PendingRef& ref = mPendingRefs[i];
+        if (ref.handle != handle) continue;
+        if ((ref.strong > 0 && strong < 0) || (ref.strong < 0 && strong > 0) ||
+            (ref.weak > 0 && weak < 0) || (ref.weak < 0 && weak > 0)) {
+            mDriverStats.refsCoalesced += 2;
+        }
+        ref.strong += strong;
+        ref.weak += weak;
+        if (ref.strong == 0 && ref.weak == 0) {
+            mPendingRefs[i] = mPendingRefs[--mPendingRefCount];
+        }
+        return;
+    }
+
+    if (mPendingRefCount == kMaxPendingRefs) {
+        writePendingRefs();
+    }
+    PendingRef& ref = mPendingRefs[mPendingRefCount++];
+    ref.handle = handle;
+    ref.strong = strong;
+    ref.weak = weak;
+}
+
+void IPCThreadState::writePendingRefs()
+{
+    for (size_t i = 0; i < mPendingRefCount; i++) {
+        const PendingRef& ref = mPendingRefs[i];
+        // Increments first, so the driver's counts never drop to zero
+        // on the way to the net values.
+        for (int32_t n = ref.weak; n > 0; n--) {
+            mOut.writeInt32(BC_INCREFS);
+            mOut.writeInt32(ref.handle);
+        }
+        for (int32_t n = ref.strong; n > 0; n--) {
+            mOut.writeInt32(BC_ACQUIRE);
+            mOut.writeInt32(ref.handle);
+        }
+        for (int32_t n = ref.strong; n < 0; n++) {
+            mOut.writeInt32(BC_RELEASE);
+            mOut.writeInt32(ref.handle);
+        }
+        for (int32_t n = ref.weak; n < 0; n++) {
+            mOut.writeInt32(BC_DECREFS);
+            mOut.writeInt32(ref.handle);
+        }
+    }
+    mPendingRefCount = 0;
 }
 
 status_t IPCThreadState::attemptIncStrongHandle(int32_t handle)
 {
 #if HAS_BC_ATTEMPT_ACQUIRE
     LOG_REMOTEREFS("IPCThreadState::attemptIncStrongHandle(%d)\n", handle);
+    writePendingRefs();
     mOut.writeInt32(BC_ATTEMPT_ACQUIRE);
     mOut.writeInt32(0); // xxx was thread priority
     mOut.writeInt32(handle);
@@ -673,6 +757,7 @@ void IPCThreadState::expungeHandle(int32_t handle, IBinder* binder)
 
 status_t IPCThreadState::requestDeathNotification(int32_t handle, BpBinder* proxy)
 {
+    writePendingRefs();
     mOut.writeInt32(BC_REQUEST_DEATH_NOTIFICATION);
     mOut.writeInt32((int32_t)handle);
     mOut.writePointer((uintptr_t)proxy);
@@ -681,6 +766,7 @@ status_t IPCThreadState::requestDeathNotification(int32_t handle, BpBinder* prox
 
 status_t IPCThreadState::clearDeathNotification(int32_t handle, BpBinder* proxy)
 {
+    writePendingRefs();
     mOut.writeInt32(BC_CLEAR_DEATH_NOTIFICATION);
     mOut.writeInt32((int32_t)handle);
     mOut.writePointer((uintptr_t)proxy);
@@ -690,24 +776,36 @@ status_t IPCThreadState::clearDeathNotification(int32_t handle, BpBinder* proxy)
 IPCThreadState::IPCThreadState()
     : mProcess(ProcessState::self()),
       mMyThreadId(gettid()),
+      mOutConsumed(0),
+      mPendingRefCount(0),
       mStrictModePolicy(0),
-      mLastTransactionBinderFlags(0)
+      mLastTransactionBinderFlags(0),
+      mLastReplyFlags(0),
+      mExclusivePoll(false),
+      mSchedPolicy(SP_DEFAULT)
 {
     pthread_setspecific(gTLS, this);
+    sSelf = this;
     clearCaller();
-    mIn.setDataCapacity(256);
+    resetDriverStats();
+    mIn.setDataCapacity(kInitialInCapacity);
     mOut.setDataCapacity(256);
 }
 
 IPCThreadState::~IPCThreadState()
 {
+    if (sSelf == this) {
+        sSelf = NULL;
+    }
 }
 
 status_t IPCThreadState::sendReply(const Parcel& reply, uint32_t flags)
 {
     status_t err;
     status_t statusBuffer;
-    err = writeTransactionData(BC_REPLY, flags, -1, 0, reply, &statusBuffer);
+    // Tells the caller's proxy it may send us compact interface tokens
+    err = writeTransactionData(BC_REPLY, flags | TF_COMPACT_TOKENS, -1, 0,
+                               reply, &statusBuffer);
     if (err < NO_ERROR) return err;
     
     return waitForResponse(NULL, NULL);
@@ -725,6 +823,7 @@ status_t IPCThreadState::waitForResponse(Parcel *reply, status_t *acquireResult)
         if (mIn.dataAvail() == 0) continue;
         
         cmd = (uint32_t)mIn.readInt32();
+        mDriverStats.commandsIn++;
         
         IF_LOG_COMMANDS() {
             alog << "Processing waitForResponse Command: "
@@ -743,6 +842,10 @@ status_t IPCThreadState::waitForResponse(Parcel *reply, status_t *acquireResult)
         case BR_FAILED_REPLY:
             err = FAILED_TRANSACTION;
             goto finish;
+
+        case BR_BUFFER_LIMIT_REPLY:
+            err = NO_MEMORY;
+            goto finish;
         
         case BR_ACQUIRE_RESULT:
             {
@@ -759,6 +862,7 @@ status_t IPCThreadState::waitForResponse(Parcel *reply, status_t *acquireResult)
                 err = mIn.read(&tr, sizeof(tr));
                 ALOG_ASSERT(err == NO_ERROR, "Not enough command data for brREPLY");
                 if (err != NO_ERROR) goto finish;
+                mLastReplyFlags = tr.flags;
 
                 if (reply) {
                     if ((tr.flags & TF_STATUS_CODE) == 0) {
@@ -809,6 +913,8 @@ status_t IPCThreadState::talkWithDriver(bool doReceive)
     if (mProcess->mDriverFD <= 0) {
         return -EBADF;
     }
+
+    writePendingRefs();
     
     binder_write_read bwr;
     
@@ -817,11 +923,13 @@ status_t IPCThreadState::talkWithDriver(bool doReceive)
     
     // We don't want to write anything if we are still reading
     // from data left in the input buffer and the caller
-    // has requested to read the next data.
-    const size_t outAvail = (!doReceive || needRead) ? mOut.dataSize() : 0;
+    // has requested to read the next data.  Commands before
+    // mOutConsumed were taken by the driver on an earlier call.
+    const size_t outAvail = (!doReceive || needRead)
+        ? mOut.dataSize() - mOutConsumed : 0;
     
     bwr.write_size = outAvail;
-    bwr.write_buffer = (uintptr_t)mOut.data();
+    bwr.write_buffer = (uintptr_t)(mOut.data() + mOutConsumed);
 
     // This is what we'll read.
     if (doReceive && needRead) {
@@ -857,6 +965,7 @@ status_t IPCThreadState::talkWithDriver(bool doReceive)
             alog << "About to read/write, write size = " << mOut.dataSize() << endl;
         }
 #if defined(HAVE_ANDROID_OS)
+        mDriverStats.writeReads++;
         if (ioctl(mProcess->mDriverFD, BINDER_WRITE_READ, &bwr) >= 0)
             err = NO_ERROR;
         else
@@ -878,17 +987,24 @@ status_t IPCThreadState::talkWithDriver(bool doReceive)
                         << "), read consumed: " << bwr.read_consumed << endl;
     }
 
+    // A read that found no work (exclusive polling) may still have consumed
+    // our commands, so drop those before reporting the error.
+    if ((err >= NO_ERROR || err == -EAGAIN) && bwr.write_consumed > 0) {
+        consumeOutput(bwr.write_consumed);
+    }
+
     if (err >= NO_ERROR) {
-        if (bwr.write_consumed > 0) {
-            if (bwr.write_consumed < mOut.dataSize())
-                mOut.remove(0, bwr.write_consumed);
-            else
-                mOut.setDataSize(0);
-        }
         if (bwr.read_consumed > 0) {
             mIn.setDataSize(bwr.read_consumed);
             mIn.setDataPosition(0);
         }
+        // The driver stops once another transaction would not fit, so a
+        // full buffer means more work is likely queued for us.
+        if (bwr.read_size - bwr.read_consumed
+                < sizeof(int32_t) + sizeof(binder_transaction_data)
+                && bwr.read_size != 0 && mIn.dataCapacity() < kMaxInCapacity) {
+            mIn.setDataCapacity(mIn.dataCapacity() * 2);
+        }
         IF_LOG_COMMANDS() {
             TextOutput::Bundle _b(alog);
             alog << "Remaining data size: " << mOut.dataSize() << endl;
@@ -905,6 +1021,25 @@ status_t IPCThreadState::talkWithDriver(bool doReceive)
     return err;
 }
 
+void IPCThreadState::consumeOutput(size_t consumed)
+{
+    mOutConsumed += consumed;
+    if (mOutConsumed >= mOut.dataSize()) {
+        mOut.setDataSize(0);
+        mOutConsumed = 0;
+    } else if (mOutConsumed > mOut.dataSize() - mOutConsumed) {
+        // Only reclaim the consumed front once it outweighs what is still
+        // pending, so partial writes cost amortized O(1) moves.  mOut holds
+        // nothing but commands, so there are no objects to fix up.
+        const size_t pending = mOut.dataSize() - mOutConsumed;
+        memmove(const_cast<uint8_t*>(mOut.data()),
+                mOut.data() + mOutConsumed, pending);
+        mOut.setDataSize(pending);
+        mOut.setDataPosition(pending);
+        mOutConsumed = 0;
+    }
+}
+
 status_t IPCThreadState::writeTransactionData(int32_t cmd, uint32_t binderFlags,
     int32_t handle, uint32_t code, const Parcel& data, status_t* statusBuffer)
 {
@@ -935,6 +1070,8 @@ status_t IPCThreadState::writeTransactionData(int32_t cmd, uint32_t binderFlags,
         return (mLastError = err);
     }
     
+    // Handles in the data must hold the references taken on them
+    writePendingRefs();
     mOut.writeInt32(cmd);
     mOut.write(&tr, sizeof(tr));
     
@@ -948,6 +1085,60 @@ void setTheContextObject(sp<BBinder> obj)
     the_context_object = obj;
 }
 
+static status_t dispatchTransaction(const binder_transaction_data& tr,
+                                    const Parcel& buffer, Parcel* reply,
+                                    const void* id)
+{
+    if (!tr.target.ptr) {
+        return the_context_object->transact(tr.code, buffer, reply, tr.flags);
+    }
+
+    // We only have a weak reference on the target object, so we must first try to
+    // safely acquire a strong reference before doing anything else with it.
+    if (!reinterpret_cast<RefBase::weakref_type*>(tr.target.ptr)->attemptIncStrong(id)) {
+        return UNKNOWN_TRANSACTION;
+    }
+    status_t error = reinterpret_cast<BBinder*>(tr.cookie)->transact(tr.code, buffer,
+            reply, tr.flags);
+    reinterpret_cast<BBinder*>(tr.cookie)->decStrong(id);
+    return error;
+}
+
+void IPCThreadState::executeOneway(const binder_transaction_data& tr)
+{
+    {
+        Parcel buffer;
+        buffer.ipcSetDataReference(
+            reinterpret_cast<const uint8_t*>(tr.data.ptr.buffer),
+            tr.data_size,
+            reinterpret_cast<const binder_size_t*>(tr.data.ptr.offsets),
+            tr.offsets_size/sizeof(binder_size_t), freeBuffer, this);
+
+        const pid_t origPid = mCallingPid;
+        const uid_t origUid = mCallingUid;
+        const int32_t origStrictModePolicy = mStrictModePolicy;
+        const int32_t origTransactionBinderFlags = mLastTransactionBinderFlags;
+
+        mCallingPid = tr.sender_pid;
+        mCallingUid = tr.sender_euid;
+        mLastTransactionBinderFlags = tr.flags;
+
+        Parcel reply;
+        dispatchTransaction(tr, buffer, &reply, this);
+
+        mCallingPid = origPid;
+        mCallingUid = origUid;
+        mStrictModePolicy = origStrictModePolicy;
+        mLastTransactionBinderFlags = origTransactionBinderFlags;
+    }
+
+    // This thread never reads from the driver, so send the BC_FREE_BUFFER
+    // for the transaction now.  That releases the next oneway call queued
+    // for the same object, which the driver hands to the binder threads
+    // since this one is not a looper.
+    flushCommands();
+}
+
 status_t IPCThreadState::executeCommand(int32_t cmd)
 {
     BBinder* obj;
@@ -1033,8 +1224,29 @@ status_t IPCThreadState::executeCommand(int32_t cmd)
             result = mIn.read(&tr, sizeof(tr));
             ALOG_ASSERT(result == NO_ERROR,
                 "Not enough command data for brTRANSACTION");
+            mDriverStats.transactionsIn++;
             if (result != NO_ERROR) break;
-            
+
+            // Newer drivers say which nice value they gave this thread for
+            // the call; the bits are not part of the call's flags.
+            const bool haveNice = (tr.flags & TF_NICE_VALID) != 0;
+            const int reportedNice =
+                    (int) ((tr.flags & TF_NICE_MASK) >> TF_NICE_SHIFT) - 20;
+            tr.flags &= ~(TF_NICE_VALID | TF_NICE_MASK);
+
+            // With an executor, a oneway call runs on a worker and this
+            // thread goes back to the driver.  The driver holds back the
+            // next oneway call to the same object until the worker frees
+            // this one's buffer, so those still run one at a time, in order.
+            TransactionExecutor* executor =
+                    mProcess->mExecutor.load(std::memory_order_acquire);
+            if ((tr.flags & TF_ONE_WAY) && executor != NULL) {
+                executor->submit([tr]() {
+                    IPCThreadState::self()->executeOneway(tr);
+                });
+                break;
+            }
+
             Parcel buffer;
             buffer.ipcSetDataReference(
                 reinterpret_cast<const uint8_t*>(tr.data.ptr.buffer),
@@ -1051,7 +1263,8 @@ status_t IPCThreadState::executeCommand(int32_t cmd)
             mCallingUid = tr.sender_euid;
             mLastTransactionBinderFlags = tr.flags;
 
-            int curPrio = getpriority(PRIO_PROCESS, mMyThreadId);
+            int curPrio = haveNice ? reportedNice
+                                   : getpriority(PRIO_PROCESS, mMyThreadId);
             if (gDisableBackgroundScheduling) {
                 if (curPrio > ANDROID_PRIORITY_NORMAL) {
                     // We have inherited a reduced priority from the caller, but do not
@@ -1061,13 +1274,15 @@ status_t IPCThreadState::executeCommand(int32_t cmd)
                     setpriority(PRIO_PROCESS, mMyThreadId, ANDROID_PRIORITY_NORMAL);
                 }
             } else {
-                if (curPrio >= ANDROID_PRIORITY_BACKGROUND) {
+                if (curPrio >= ANDROID_PRIORITY_BACKGROUND
+                        && mSchedPolicy != SP_BACKGROUND) {
                     // We want to use the inherited priority from the caller.
                     // Ensure this thread is in the background scheduling class,
                     // since the driver won't modify scheduling classes for us.
                     // The scheduling group is reset to default by the caller
                     // once this method returns after the transaction is complete.
                     set_sched_policy(mMyThreadId, SP_BACKGROUND);
+                    mSchedPolicy = SP_BACKGROUND;
                 }
             }
 
@@ -1086,21 +1301,7 @@ status_t IPCThreadState::executeCommand(int32_t cmd)
                     << ", offsets addr="
                     << reinterpret_cast<const size_t*>(tr.data.ptr.offsets) << endl;
             }
-            if (tr.target.ptr) {
-                // We only have a weak reference on the target object, so we must first try to
-                // safely acquire a strong reference before doing anything else with it.
-                if (reinterpret_cast<RefBase::weakref_type*>(
-                        tr.target.ptr)->attemptIncStrong(this)) {
-                    error = reinterpret_cast<BBinder*>(tr.cookie)->transact(tr.code, buffer,
-                            &reply, tr.flags);
-                    reinterpret_cast<BBinder*>(tr.cookie)->decStrong(this);
-                } else {
-                    error = UNKNOWN_TRANSACTION;
-                }
-
-            } else {
-                error = the_context_object->transact(tr.code, buffer, &reply, tr.flags);
-            }
+            error = dispatchTransaction(tr, buffer, &reply, this);
 
             //ALOGI("<<<< TRANSACT from pid %d restore pid %d uid %d\n",
             //     mCallingPid, origPid, origUid);
@@ -1192,6 +1393,9 @@ void IPCThreadState::freeBuffer(Parcel* parcel, const uint8_t* data,
     ALOG_ASSERT(data != NULL, "Called with NULL data");
     if (parcel != NULL) parcel->closeFileDescriptors();
     IPCThreadState* state = self();
+    // Proxies made from the buffer's handles must take their references
+    // before the buffer gives up its own
+    state->writePendingRefs();
     state->mOut.writeInt32(BC_FREE_BUFFER);
     state->mOut.writePointer((uintptr_t)data);
 }
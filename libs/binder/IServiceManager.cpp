@@ -19,10 +19,14 @@
 #include <binder/IServiceManager.h>
 
 #include <utils/Log.h>
+#include <binder/BpBinder.h>
 #include <binder/IPCThreadState.h>
 #include <binder/Parcel.h>
+#include <utils/Condition.h>
+#include <utils/KeyedVector.h>
 #include <utils/String8.h>
 #include <utils/SystemClock.h>
+#include <utils/Timers.h>
 
 #include <private/binder/Static.h>
 
@@ -123,7 +127,53 @@ bool checkPermission(const String16& permission, pid_t pid, uid_t uid)
 
 // ----------------------------------------------------------------------
 
-class BpServiceManager : public BpInterface<IServiceManager>
+sp<IBinder> IServiceManager::waitForService(const String16& name)
+{
+    for (;;) {
+        sp<IBinder> svc = checkService(name);
+        if (svc != NULL) return svc;
+        sleep(1);
+    }
+}
+
+// ----------------------------------------------------------------------
+
+// Passed to servicemanager with NOTIFY_SERVICE_TRANSACTION, which calls
+// it back with the service once that is registered.
+class ServiceWaiter : public BBinder
+{
+public:
+    sp<IBinder> wait(nsecs_t timeout)
+    {
+        AutoMutex _l(mLock);
+        if (mService == NULL) {
+            mCondition.waitRelative(mLock, timeout);
+        }
+        return mService;
+    }
+
+protected:
+    virtual status_t onTransact(uint32_t code, const Parcel& data,
+                                Parcel* reply, uint32_t flags = 0)
+    {
+        if (code != IServiceManager::SERVICE_REGISTERED_TRANSACTION) {
+            return BBinder::onTransact(code, data, reply, flags);
+        }
+        sp<IBinder> service = data.readStrongBinder();
+        AutoMutex _l(mLock);
+        mService = service;
+        mCondition.broadcast();
+        return NO_ERROR;
+    }
+
+private:
+    Mutex mLock;
+    Condition mCondition;
+    sp<IBinder> mService;
+};
+
+class BpServiceManager : public BpInterface<IServiceManager>,
+                         public IBinder::DeathRecipient
 {
 public:
     BpServiceManager(const sp<IBinder>& impl)
@@ -133,34 +183,46 @@ public:
 
     virtual sp<IBinder> getService(const String16& name) const
     {
-        unsigned n;
-        for (n = 0; n < 5; n++){
-            sp<IBinder> svc = checkService(name);
-            if (svc != NULL) return svc;
-            ALOGI("Waiting for service %s...\n", String8(name).string());
-            sleep(1);
-        }
-        return NULL;
+        sp<IBinder> svc = checkService(name);
+        if (svc != NULL) return svc;
+        ALOGI("Waiting for service %s...\n", String8(name).string());
+        return waitForService(name, s2ns(5));
     }
 
     virtual sp<IBinder> checkService( const String16& name) const
     {
+        sp<IBinder> svc = lookupCache(name);
+        if (svc != NULL) return svc;
+
         Parcel data, reply;
-        data.writeInterfaceToken(IServiceManager::getInterfaceDescriptor());
+        reserveRequest(CHECK_SERVICE_TRANSACTION, &data);
+        data.writeInterfaceToken(IServiceManager::getInterfaceDescriptor(), remote());
         data.writeString16(name);
         remote()->transact(CHECK_SERVICE_TRANSACTION, data, &reply);
-        return reply.readStrongBinder();
+        svc = reply.readStrongBinder();
+        addToCache(name, svc);
+        return svc;
+    }
+
+    virtual sp<IBinder> waitForService(const String16& name)
+    {
+        sp<IBinder> svc = checkService(name);
+        if (svc != NULL) return svc;
+        ALOGI("Waiting for service %s...\n", String8(name).string());
+        return waitForService(name, -1);
     }
 
     virtual status_t addService(const String16& name, const sp<IBinder>& service,
             bool allowIsolated)
     {
         Parcel data, reply;
-        data.writeInterfaceToken(IServiceManager::getInterfaceDescriptor());
+        reserveRequest(ADD_SERVICE_TRANSACTION, &data);
+        data.writeInterfaceToken(IServiceManager::getInterfaceDescriptor(), remote());
         data.writeString16(name);
         data.writeStrongBinder(service);
         data.writeInt32(allowIsolated ? 1 : 0);
         status_t err = remote()->transact(ADD_SERVICE_TRANSACTION, data, &reply);
+        removeFromCache(name, NULL);
         return err == NO_ERROR ? reply.readExceptionCode() : err;
     }
 
@@ -171,7 +233,8 @@ public:
 
         for (;;) {
             Parcel data, reply;
-            data.writeInterfaceToken(IServiceManager::getInterfaceDescriptor());
+            reserveRequest(LIST_SERVICES_TRANSACTION, &data);
+            data.writeInterfaceToken(IServiceManager::getInterfaceDescriptor(), remote());
             data.writeInt32(n++);
             status_t err = remote()->transact(LIST_SERVICES_TRANSACTION, data, &reply);
             if (err != NO_ERROR)
@@ -180,6 +243,114 @@ public:
         }
         return res;
     }
+
+    virtual void binderDied(const wp<IBinder>& who)
+    {
+        AutoMutex _l(mCacheLock);
+        for (size_t i = mCache.size(); i-- > 0; ) {
+            if (mCache.valueAt(i).get() == who.unsafe_get()) {
+                mCache.removeItemsAt(i);
+            }
+        }
+    }
+
+private:
+    // Waits up to timeout, or forever if negative.  The wait is normally
+    // ended by servicemanager's notification, but checking once a second
+    // also covers an older servicemanager and processes with no thread
+    // to receive the notification.  A wait ended any other way cancels
+    // the notification, so that servicemanager lets go of the waiter.
+    sp<IBinder> waitForService(const String16& name, nsecs_t timeout) const
+    {
+        sp<ServiceWaiter> waiter = new ServiceWaiter();
+        Parcel data, reply;
+        reserveRequest(NOTIFY_SERVICE_TRANSACTION, &data);
+        data.writeInterfaceToken(IServiceManager::getInterfaceDescriptor(), remote());
+        data.writeString16(name);
+        data.writeStrongBinder(waiter);
+        sp<IBinder> svc;
+        bool waiting = false;
+        if (remote()->transact(NOTIFY_SERVICE_TRANSACTION, data, &reply) == NO_ERROR) {
+            svc = reply.readStrongBinder();
+            addToCache(name, svc);
+            waiting = svc == NULL;
+        }
+
+        const nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + timeout;
+        while (svc == NULL) {
+            nsecs_t wait = s2ns(1);
+            if (timeout >= 0) {
+                const nsecs_t left = deadline - systemTime(SYSTEM_TIME_MONOTONIC);
+                if (left <= 0) break;
+                if (left < wait) wait = left;
+            }
+            svc = waiter->wait(wait);
+            if (svc != NULL) {
+                addToCache(name, svc);
+                waiting = false;
+            } else {
+                svc = checkService(name);
+            }
+        }
+        if (waiting) {
+            cancelNotify(name, waiter);
+        }
+        return svc;
+    }
+
+    void cancelNotify(const String16& name, const sp<IBinder>& waiter) const
+    {
+        Parcel data, reply;
+        reserveRequest(CANCEL_NOTIFY_TRANSACTION, &data);
+        data.writeInterfaceToken(IServiceManager::getInterfaceDescriptor(), remote());
+        data.writeString16(name);
+        data.writeStrongBinder(waiter);
+        remote()->transact(CANCEL_NOTIFY_TRANSACTION, data, &reply);
+    }
+
+    sp<IBinder> lookupCache(const String16& name) const
+    {
+        AutoMutex _l(mCacheLock);
+        ssize_t i = mCache.indexOfKey(name);
+        if (i < 0) return NULL;
+        sp<IBinder> svc = mCache.valueAt(i);
+        // A proxy knows it is dead once a call on it fails, even if this
+        // process never reads the death notification.
+        if (!svc->isBinderAlive()) {
+            mCache.removeItemsAt(i);
+            return NULL;
+        }
+        return svc;
+    }
+
+    void addToCache(const String16& name, const sp<IBinder>& svc) const
+    {
+        if (svc == NULL) return;
+        {
+            AutoMutex _l(mCacheLock);
+            mCache.replaceValueFor(name, svc);
+        }
+        // Linked once added, so that a death reported right away still
+        // finds the entry to remove.
+        BpBinder* proxy = svc->remoteBinder();
+        if (proxy != NULL && proxy->linkToDeath(
+                const_cast<BpServiceManager*>(this)) != NO_ERROR) {
+            removeFromCache(name, svc);
+        }
+    }
+
+    // Removes name's entry, if it is svc or svc is NULL.
+    void removeFromCache(const String16& name, const sp<IBinder>& svc) const
+    {
+        AutoMutex _l(mCacheLock);
+        ssize_t i = mCache.indexOfKey(name);
+        if (i >= 0 && (svc == NULL || mCache.valueAt(i) == svc)) {
+            mCache.removeItemsAt(i);
+        }
+    }
+
+    mutable Mutex mCacheLock;
+    mutable KeyedVector<String16, sp<IBinder> > mCache;
 };
 
 IMPLEMENT_META_INTERFACE(ServiceManager, "android.os.IServiceManager");
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "LooperBinderServer"
+
+#include <binder/LooperBinderServer.h>
+
+#include <binder/IPCThreadState.h>
+#include <binder/ProcessState.h>
+#include <utils/Log.h>
+
+#include <errno.h>
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+LooperBinderServer::LooperBinderServer(const sp<Looper>& looper)
+    : mLooper(looper), mFd(-1)
+{
+}
+
+LooperBinderServer::~LooperBinderServer()
+{
+}
+
+status_t LooperBinderServer::start()
+{
+    if (mFd >= 0 || Looper::getForThread() != mLooper) {
+        return INVALID_OPERATION;
+    }
+
+    ProcessState::self()->setThreadPoolMaxThreadCount(0);
+
+    // An exclusive poller drains the driver on each wakeup.  Drivers
+    // without exclusive polling still work, a read's worth at a time.
+    IPCThreadState* ipc = IPCThreadState::self();
+    int fd;
+    int result = ipc->setupPolling(&fd, true);
+    if (result != 0) {
+        result = ipc->setupPolling(&fd, false);
+    }
+    if (result != 0) {
+        return result;
+    }
+    // Enter the looper now rather than with the first reply.
+    ipc->flushCommands();
+
+    if (mLooper->addFd(fd, Looper::POLL_CALLBACK, Looper::EVENT_INPUT,
+                       this, NULL) != 1) {
+        return UNKNOWN_ERROR;
+    }
+    mFd = fd;
+    return NO_ERROR;
+}
+
+void LooperBinderServer::stop()
+{
+    if (mFd >= 0) {
+        mLooper->removeFd(mFd);
+        mFd = -1;
+    }
+}
+
+int LooperBinderServer::handleEvent(int fd, int events, void* /*data*/)
+{
+    if (fd != mFd) {
+        return 0;  // No longer serving this fd
+    }
+    if (events & (Looper::EVENT_ERROR | Looper::EVENT_HANGUP)) {
+        ALOGE("binder fd %d reported events 0x%x, no longer serving", fd, events);
+        mFd = -1;
+        return 0;
+    }
+
+    status_t result = IPCThreadState::self()->handlePolledCommands();
+    if (result == -EBADF) {
+        mFd = -1;
+        return 0;
+    }
+    ALOGW_IF(result != NO_ERROR, "handlePolledCommands() returned %d", result);
+    return 1;
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
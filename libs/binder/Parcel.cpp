@@ -19,6 +19,7 @@
 
 #include <binder/Parcel.h>
 
+#include <binder/BlobPool.h>
 #include <binder/IPCThreadState.h>
 #include <binder/Binder.h>
 #include <binder/BpBinder.h>
@@ -32,12 +33,15 @@
 #include <utils/String16.h>
 #include <utils/misc.h>
 #include <utils/Flattenable.h>
+#include <utils/SharedBuffer.h>
 #include <cutils/ashmem.h>
 
 #include <private/binder/binder_module.h>
 #include <private/binder/Static.h>
 
+#include <atomic>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -77,6 +81,10 @@ static size_t pad_size(size_t s) {
 // Note: must be kept in sync with android/os/Parcel.java's EX_HAS_REPLY_HEADER
 #define EX_HAS_REPLY_HEADER -128
 
+// Written in place of the interface name's length when the name is sent as
+// a 64-bit id; an older reader sees a bad length and fails the check.
+#define COMPACT_INTERFACE_TOKEN -2
+
 // XXX This can be made public if we want to provide
 // support for typed data.
 struct small_flat_data
@@ -87,10 +95,6 @@ struct small_flat_data
 
 namespace android {
 
-static pthread_mutex_t gParcelGlobalAllocSizeLock = PTHREAD_MUTEX_INITIALIZER;
-static size_t gParcelGlobalAllocSize = 0;
-static size_t gParcelGlobalAllocCount = 0;
-
 // Maximum size of a blob to transfer in-place.
 static const size_t BLOB_INPLACE_LIMIT = 16 * 1024;
 
@@ -98,8 +102,15 @@ enum {
     BLOB_INPLACE = 0,
     BLOB_ASHMEM_IMMUTABLE = 1,
     BLOB_ASHMEM_MUTABLE = 2,
+    BLOB_POOL_IMMUTABLE = 3,
+    BLOB_POOL_MUTABLE = 4,
 };
 
+// Set in the flat_binder_object of a pool blob's heap.  The driver passes
+// an object's flags through untouched, so this is what tells a pool blob
+// apart from any other int32 followed by a binder.
+static const uint32_t FLAT_BINDER_FLAG_BLOB_POOL = 0x40000000;
+
 void acquire_object(const sp<ProcessState>& proc,
     const flat_binder_object& obj, const void* who, size_t* outAshmemSize)
 {
@@ -345,6 +356,193 @@ status_t unflatten_binder(const sp<ProcessState>& proc,
 
 // ---------------------------------------------------------------------------
 
+// Buffers too big for a parcel's inline storage come from a small per-thread
+// cache of recently freed ones, in power-of-two size classes from
+// ARENA_MIN_SIZE to ARENA_MAX_SIZE.  Larger buffers go straight to malloc.
+// A buffer freed on another thread simply joins that thread's cache.
+enum {
+    ARENA_MIN_SHIFT = 8,
+    ARENA_CLASSES = 8,
+    ARENA_DEPTH = 2,
+    ARENA_MIN_SIZE = 1 << ARENA_MIN_SHIFT,
+    ARENA_MAX_SIZE = ARENA_MIN_SIZE << (ARENA_CLASSES - 1),
+};
+
+struct parcel_arena
+{
+    void* buffers[ARENA_CLASSES][ARENA_DEPTH];
+    size_t counts[ARENA_CLASSES];
+    size_t statsShard;
+};
+
+// The global allocation statistics are only read for debugging, so rather
+// than serializing every allocation on one lock each thread adds to its
+// own shard and the getters sum them.  A buffer freed on a different
+// thread than it was allocated on can drive a shard negative; the sum
+// still comes out right.
+enum {
+    ALLOC_STATS_SHARDS = 16,
+};
+
+struct alloc_stats_shard
+{
+    std::atomic<ssize_t> size;
+    std::atomic<ssize_t> count;
+} __attribute__((aligned(64)));
+
+static alloc_stats_shard gParcelAllocStats[ALLOC_STATS_SHARDS];
+static std::atomic<size_t> gParcelAllocStatsNextShard(0);
+
+static pthread_once_t gParcelArenaOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gParcelArenaKey;
+
+static void arena_destroy(void* st)
+{
+    parcel_arena* arena = static_cast<parcel_arena*>(st);
+    for (size_t i = 0; i < ARENA_CLASSES; i++) {
+        for (size_t j = 0; j < arena->counts[i]; j++) {
+            free(arena->buffers[i][j]);
+        }
+    }
+    free(arena);
+}
+
+static void arena_init_key()
+{
+    pthread_key_create(&gParcelArenaKey, arena_destroy);
+}
+
+static parcel_arena* arena_get(bool create)
+{
+    pthread_once(&gParcelArenaOnce, arena_init_key);
+    parcel_arena* arena =
+        static_cast<parcel_arena*>(pthread_getspecific(gParcelArenaKey));
+    if (arena == NULL && create) {
+        arena = static_cast<parcel_arena*>(calloc(1, sizeof(parcel_arena)));
+        if (arena != NULL) {
+            arena->statsShard = gParcelAllocStatsNextShard.fetch_add(1,
+                    std::memory_order_relaxed) % ALLOC_STATS_SHARDS;
+            pthread_setspecific(gParcelArenaKey, arena);
+        }
+    }
+    return arena;
+}
+
+static void alloc_stats_add(ssize_t size, ssize_t count)
+{
+    parcel_arena* arena = arena_get(true);
+    alloc_stats_shard& shard = gParcelAllocStats[arena ? arena->statsShard : 0];
+    shard.size.fetch_add(size, std::memory_order_relaxed);
+    if (count) shard.count.fetch_add(count, std::memory_order_relaxed);
+}
+
+static ssize_t alloc_stats_sum(std::atomic<ssize_t> alloc_stats_shard::* field)
+{
+    ssize_t sum = 0;
+    for (size_t i = 0; i < ALLOC_STATS_SHARDS; i++) {
+        sum += (gParcelAllocStats[i].*field).load(std::memory_order_relaxed);
+    }
+    return sum < 0 ? 0 : sum;
+}
+
+// Size class index for a buffer of size bytes, or -1 if it is not cached.
+static int arena_class(size_t size)
+{
+    if (size > ARENA_MAX_SIZE) return -1;
+    int idx = 0;
+    while ((size_t)(ARENA_MIN_SIZE << idx) < size) idx++;
+    return idx;
+}
+
+// Rounds *size up to its size class and returns a buffer of that size.
+static void* arena_alloc(size_t* size)
+{
+    const int idx = arena_class(*size);
+    if (idx < 0) return malloc(*size);
+
+    *size = ARENA_MIN_SIZE << idx;
+    parcel_arena* arena = arena_get(true);
+    if (arena != NULL && arena->counts[idx] > 0) {
+        return arena->buffers[idx][--arena->counts[idx]];
+    }
+    return malloc(*size);
+}
+
+static void arena_free(void* buffer, size_t size)
+{
+    const int idx = arena_class(size);
+    // Only exact class sizes came from arena_alloc().
+    if (idx >= 0 && (size_t)(ARENA_MIN_SIZE << idx) == size) {
+        parcel_arena* arena = arena_get(false);
+        if (arena != NULL && arena->counts[idx] < ARENA_DEPTH) {
+            arena->buffers[idx][arena->counts[idx]++] = buffer;
+            return;
+        }
+    }
+    free(buffer);
+}
+
+// ---------------------------------------------------------------------------
+
+// Interned interface tokens.  The id of an interface name is a 64-bit
+// FNV-1a hash of its UTF-16 units, so any two processes agree on it
+// without a handshake.  Descriptors are long-lived String16s, so ids are
+// cached by buffer address; each entry keeps a reference on the buffer,
+// so the address cannot be reused for another string.  Lookups take no
+// lock; once the table is full ids are simply hashed on every call.
+
+enum {
+    TOKEN_TABLE_SIZE = 64,
+};
+
+struct interned_token {
+    std::atomic<const char16_t*> str;
+    uint64_t id;
+};
+
+static interned_token gInternedTokens[TOKEN_TABLE_SIZE];
+static pthread_mutex_t gInternedTokensLock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t token_hash(const char16_t* str, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint16_t)str[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t intern_token(const String16& interface)
+{
+    const char16_t* str = interface.string();
+    const size_t start = ((uintptr_t)str >> 4) % TOKEN_TABLE_SIZE;
+
+    for (size_t i = 0; i < TOKEN_TABLE_SIZE; i++) {
+        interned_token& entry = gInternedTokens[(start + i) % TOKEN_TABLE_SIZE];
+        const char16_t* cur = entry.str.load(std::memory_order_acquire);
+        if (cur == str) return entry.id;
+        if (cur == NULL) break;
+    }
+
+    const uint64_t id = token_hash(str, interface.size());
+    pthread_mutex_lock(&gInternedTokensLock);
+    for (size_t i = 0; i < TOKEN_TABLE_SIZE; i++) {
+        interned_token& entry = gInternedTokens[(start + i) % TOKEN_TABLE_SIZE];
+        const char16_t* cur = entry.str.load(std::memory_order_relaxed);
+        if (cur == str) break;
+        if (cur == NULL) {
+            SharedBuffer::bufferFromData(str)->acquire();
+            entry.id = id;
+            entry.str.store(str, std::memory_order_release);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&gInternedTokensLock);
+    return id;
+}
+
+// ---------------------------------------------------------------------------
+
 Parcel::Parcel()
 {
     LOG_ALLOC("Parcel %p: constructing", this);
@@ -358,17 +556,16 @@ Parcel::~Parcel()
 }
 
 size_t Parcel::getGlobalAllocSize() {
-    pthread_mutex_lock(&gParcelGlobalAllocSizeLock);
-    size_t size = gParcelGlobalAllocSize;
-    pthread_mutex_unlock(&gParcelGlobalAllocSizeLock);
-    return size;
+    return alloc_stats_sum(&alloc_stats_shard::size);
 }
 
 size_t Parcel::getGlobalAllocCount() {
-    pthread_mutex_lock(&gParcelGlobalAllocSizeLock);
-    size_t count = gParcelGlobalAllocCount;
-    pthread_mutex_unlock(&gParcelGlobalAllocSizeLock);
-    return count;
+    return alloc_stats_sum(&alloc_stats_shard::count);
+}
+
+void Parcel::setBlobPool(const sp<BlobPool>& pool)
+{
+    mBlobPool = pool;
 }
 
 const uint8_t* Parcel::data() const
@@ -443,6 +640,18 @@ status_t Parcel::setDataCapacity(size_t size)
     return NO_ERROR;
 }
 
+status_t Parcel::reserve(size_t len)
+{
+    if (len > INT32_MAX) {
+        // don't accept size_t values which may have come from an
+        // inadvertent conversion from a negative int.
+        return BAD_VALUE;
+    }
+
+    if (mDataPos + len <= mDataCapacity) return NO_ERROR;
+    return continueWrite(mDataPos + len);
+}
+
 status_t Parcel::setData(const uint8_t* buffer, size_t len)
 {
     if (len > INT32_MAX) {
@@ -519,13 +728,10 @@ status_t Parcel::appendFrom(const Parcel *parcel, size_t offset, size_t len)
         if (mObjectsCapacity < mObjectsSize + numObjects) {
             size_t newSize = ((mObjectsSize + numObjects)*3)/2;
             if (newSize < mObjectsSize) return NO_MEMORY;   // overflow
-            binder_size_t *objects =
-                (binder_size_t*)realloc(mObjects, newSize*sizeof(binder_size_t));
-            if (objects == (binder_size_t*)0) {
-                return NO_MEMORY;
+            err = growObjects(newSize);
+            if (err != NO_ERROR) {
+                return err;
             }
-            mObjects = objects;
-            mObjectsCapacity = newSize;
         }
 
         // append and acquire objects
@@ -592,6 +798,26 @@ status_t Parcel::writeInterfaceToken(const String16& interface)
     return writeString16(interface);
 }
 
+status_t Parcel::writeInterfaceToken(const String16& interface,
+                                     const sp<IBinder>& target)
+{
+    if (target != NULL) {
+        BpBinder* proxy = target->remoteBinder();
+        if (proxy == NULL || proxy->acceptsCompactInterfaceTokens()) {
+            return writeCompactInterfaceToken(interface);
+        }
+    }
+    return writeInterfaceToken(interface);
+}
+
+status_t Parcel::writeCompactInterfaceToken(const String16& interface)
+{
+    writeInt32(IPCThreadState::self()->getStrictModePolicy() |
+               STRICT_MODE_PENALTY_GATHER);
+    writeInt32(COMPACT_INTERFACE_TOKEN);
+    return writeUint64(intern_token(interface));
+}
+
 bool Parcel::checkInterface(IBinder* binder) const
 {
     return enforceInterface(binder->getInterfaceDescriptor());
@@ -614,12 +840,27 @@ bool Parcel::enforceInterface(const String16& interface,
     } else {
       threadState->setStrictModePolicy(strictPolicy);
     }
-    const String16 str(readString16());
-    if (str == interface) {
+    if (mDataPos + sizeof(int32_t) <= mDataSize
+            && *reinterpret_cast<const int32_t*>(mData + mDataPos)
+                == COMPACT_INTERFACE_TOKEN) {
+        readInt32();
+        const uint64_t id = readUint64();
+        if (id == intern_token(interface)) {
+            return true;
+        }
+        ALOGW("**** enforceInterface() expected '%s' but read id %016" PRIx64,
+                String8(interface).string(), id);
+        return false;
+    }
+    size_t len;
+    const char16_t* str = readString16Inplace(&len);
+    if (str != NULL
+            && strzcmp16(str, len, interface.string(), interface.size()) == 0) {
         return true;
     } else {
         ALOGW("**** enforceInterface() expected '%s' but read '%s'",
-                String8(interface).string(), String8(str).string());
+                String8(interface).string(),
+                str ? String8(str, len).string() : "");
         return false;
     }
 }
@@ -760,7 +1001,8 @@ status_t Parcel::writeUint32(uint32_t val)
     return writeAligned(val);
 }
 
-status_t Parcel::writeInt32Array(size_t len, const int32_t *val) {
+status_t Parcel::writeArray(size_t len, const void* val, size_t elemSize)
+{
     if (len > INT32_MAX) {
         // don't accept size_t values which may have come from an
         // inadvertent conversion from a negative int.
@@ -770,29 +1012,40 @@ status_t Parcel::writeInt32Array(size_t len, const int32_t *val) {
     if (!val) {
         return writeInt32(-1);
     }
-    status_t ret = writeInt32(static_cast<uint32_t>(len));
-    if (ret == NO_ERROR) {
-        ret = write(val, len * sizeof(*val));
-    }
-    return ret;
-}
-status_t Parcel::writeByteArray(size_t len, const uint8_t *val) {
-    if (len > INT32_MAX) {
-        // don't accept size_t values which may have come from an
-        // inadvertent conversion from a negative int.
+    if (elemSize != 0 && len > INT32_MAX / elemSize) {
         return BAD_VALUE;
     }
+    const size_t size = len * elemSize;
 
-    if (!val) {
-        return writeInt32(-1);
+    // Make room for the count and the elements together, so even a large
+    // array costs at most one reallocation.
+    const size_t needed = sizeof(int32_t) + pad_size(size);
+    if (mDataPos + needed > mDataCapacity) {
+        status_t err = growData(needed);
+        if (err != NO_ERROR) {
+            return err;
+        }
     }
+
     status_t ret = writeInt32(static_cast<uint32_t>(len));
     if (ret == NO_ERROR) {
-        ret = write(val, len * sizeof(*val));
+        ret = write(val, size);
     }
     return ret;
 }
 
+status_t Parcel::writeInt32Array(size_t len, const int32_t *val) {
+    return writeArray(len, val, sizeof(*val));
+}
+
+status_t Parcel::writeFloatArray(size_t len, const float *val) {
+    return writeArray(len, val, sizeof(*val));
+}
+
+status_t Parcel::writeByteArray(size_t len, const uint8_t *val) {
+    return writeArray(len, val, sizeof(*val));
+}
+
 status_t Parcel::writeInt64(int64_t val)
 {
     return writeAligned(val);
@@ -940,6 +1193,37 @@ status_t Parcel::writeBlob(size_t len, bool mutableCopy, WritableBlob* outBlob)
     }
 
     status_t status;
+    if (len > BLOB_INPLACE_LIMIT && mBlobPool != NULL) {
+        size_t offset;
+        uint32_t ticket;
+        void* ptr = mBlobPool->acquire(len, &offset, &ticket);
+        if (ptr != NULL) {
+            ALOGV("writeBlob: write to pool");
+            status = writeInt32(mutableCopy ? BLOB_POOL_MUTABLE : BLOB_POOL_IMMUTABLE);
+            if (!status) {
+                status = writeStrongBinder(IInterface::asBinder(mBlobPool->heap()));
+            }
+            if (!status) {
+                flat_binder_object* flat = reinterpret_cast<flat_binder_object*>(
+                        mData + mObjects[mObjectsSize - 1]);
+                flat->flags |= FLAT_BINDER_FLAG_BLOB_POOL;
+            }
+            if (!status) {
+                status = writeUint64(offset);
+            }
+            if (!status) {
+                status = writeUint32(ticket);
+            }
+            if (!status) {
+                outBlob->init(-1, ptr, len, mutableCopy);
+                return NO_ERROR;
+            }
+            BlobPool::release(ptr, ticket);
+            return status;
+        }
+        // The pool is full, fall back to a region of its own.
+    }
+
     if (!mAllowFds || len <= BLOB_INPLACE_LIMIT) {
         ALOGV("writeBlob: write in place");
         status = writeInt32(BLOB_INPLACE);
@@ -1071,10 +1355,8 @@ restart_write:
     if (!enoughObjects) {
         size_t newSize = ((mObjectsSize+2)*3)/2;
         if (newSize < mObjectsSize) return NO_MEMORY;   // overflow
-        binder_size_t* objects = (binder_size_t*)realloc(mObjects, newSize*sizeof(binder_size_t));
-        if (objects == NULL) return NO_MEMORY;
-        mObjects = objects;
-        mObjectsCapacity = newSize;
+        const status_t err = growObjects(newSize);
+        if (err != NO_ERROR) return err;
     }
 
     goto restart_write;
@@ -1284,6 +1566,54 @@ intptr_t Parcel::readIntPtr() const
 }
 
 
+status_t Parcel::readArrayInplace(const void** outData, size_t* outLen,
+                                  size_t elemSize) const
+{
+    *outData = NULL;
+    *outLen = 0;
+
+    int32_t len;
+    status_t err = readInt32(&len);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    if (len < 0) {
+        // -1 is a NULL array
+        return (len == -1) ? (status_t) NO_ERROR : BAD_VALUE;
+    }
+    if (elemSize != 0 && (size_t) len > INT32_MAX / elemSize) {
+        return BAD_VALUE;
+    }
+
+    const void* data = readInplace(len * elemSize);
+    if (data == NULL) {
+        return NOT_ENOUGH_DATA;
+    }
+    *outData = data;
+    *outLen = len;
+    return NO_ERROR;
+}
+
+status_t Parcel::readInt32Array(Vector<int32_t>* val) const
+{
+    return readPodArray(val);
+}
+
+status_t Parcel::readFloatArray(Vector<float>* val) const
+{
+    return readPodArray(val);
+}
+
+const int32_t* Parcel::readInt32ArrayInplace(size_t* outLen) const
+{
+    return readPodArrayInplace<int32_t>(outLen);
+}
+
+const float* Parcel::readFloatArrayInplace(size_t* outLen) const
+{
+    return readPodArrayInplace<float>(outLen);
+}
+
 const char* Parcel::readCString() const
 {
     const size_t avail = mDataSize-mDataPos;
@@ -1422,6 +1752,27 @@ status_t Parcel::readBlob(size_t len, ReadableBlob* outBlob) const
         return NO_ERROR;
     }
 
+    if (blobType == BLOB_POOL_IMMUTABLE || blobType == BLOB_POOL_MUTABLE) {
+        ALOGV("readBlob: read from pool");
+        sp<IBinder> binder = readStrongBinder();
+        const uint64_t offset = readUint64();
+        const uint32_t ticket = readUint32();
+        if (binder == NULL) return BAD_VALUE;
+
+        sp<IMemoryHeap> heap = BlobPool::mapHeap(binder);
+        if (heap == NULL) return NO_MEMORY;
+        const size_t size = heap->getSize();
+        if (offset < BlobPool::HEADER_SIZE || offset > size || len > size - offset) {
+            return BAD_VALUE;
+        }
+
+        outBlob->init(-1, static_cast<uint8_t*>(heap->getBase()) + offset, len,
+                blobType == BLOB_POOL_MUTABLE);
+        outBlob->mHeap = heap;
+        outBlob->mTicket = ticket;
+        return NO_ERROR;
+    }
+
     ALOGV("readBlob: read from ashmem");
     bool isMutable = (blobType == BLOB_ASHMEM_MUTABLE);
     int fd = readFileDescriptor();
@@ -1567,6 +1918,20 @@ size_t Parcel::ipcDataSize() const
 
 uintptr_t Parcel::ipcObjects() const
 {
+    // When there is room, stage the offsets right behind the pointer-aligned
+    // data.  That matches the layout of the driver's buffer, so the driver
+    // can bring data and offsets over with a single copy.
+    if (mObjectsSize > 0 && mOwner == NULL) {
+        const size_t dataSize = ipcDataSize();
+        const size_t alignedSize = (dataSize + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+        const size_t objectsSize = mObjectsSize*sizeof(binder_size_t);
+        if (alignedSize + objectsSize <= mDataCapacity) {
+            // Don't hand stale bytes to the other side through the padding.
+            memset(mData + dataSize, 0, alignedSize - dataSize);
+            memcpy(mData + alignedSize, mObjects, objectsSize);
+            return reinterpret_cast<uintptr_t>(mData + alignedSize);
+        }
+    }
     return reinterpret_cast<uintptr_t>(mObjects);
 }
 
@@ -1658,6 +2023,35 @@ void Parcel::acquireObjects()
     }
 }
 
+void Parcel::releasePoolBlobs() const
+{
+    // A pool blob is its type, the heap's binder, the offset and the
+    // ticket; writeBlob() flags the binder object.  Only heaps of this
+    // process or already mapped are used, so this never makes a call.
+    const size_t pos = mDataPos;
+    for (size_t i = 0; i < mObjectsSize; i++) {
+        const binder_size_t off = mObjects[i];
+        const flat_binder_object* flat
+            = reinterpret_cast<const flat_binder_object*>(mData + off);
+        if ((flat->flags & FLAT_BINDER_FLAG_BLOB_POOL) == 0) continue;
+
+        mDataPos = off;
+        sp<IBinder> binder = readStrongBinder();
+        uint64_t offset;
+        uint32_t ticket;
+        if (binder == NULL || readUint64(&offset) != NO_ERROR
+                || readUint32(&ticket) != NO_ERROR) {
+            continue;
+        }
+        sp<IMemoryHeap> heap = BlobPool::findHeap(binder);
+        if (heap == NULL) continue;
+        const size_t size = heap->getSize();
+        if (offset < BlobPool::HEADER_SIZE || offset > size) continue;
+        BlobPool::release(static_cast<uint8_t*>(heap->getBase()) + offset, ticket);
+    }
+    mDataPos = pos;
+}
+
 void Parcel::freeData()
 {
     freeDataNoInit();
@@ -1669,20 +2063,60 @@ void Parcel::freeDataNoInit()
     if (mOwner) {
         LOG_ALLOC("Parcel %p: freeing other owner data", this);
         //ALOGI("Freeing data ref of %p (pid=%d)", this, getpid());
+        releasePoolBlobs();
         mOwner(this, mData, mDataSize, mObjects, mObjectsSize, mOwnerCookie);
     } else {
         LOG_ALLOC("Parcel %p: freeing allocated data", this);
         releaseObjects();
         if (mData) {
             LOG_ALLOC("Parcel %p: freeing with %zu capacity", this, mDataCapacity);
-            pthread_mutex_lock(&gParcelGlobalAllocSizeLock);
-            gParcelGlobalAllocSize -= mDataCapacity;
-            gParcelGlobalAllocCount--;
-            pthread_mutex_unlock(&gParcelGlobalAllocSizeLock);
-            free(mData);
+            alloc_stats_add(-(ssize_t)mDataCapacity, -1);
+            releaseData(mData, mDataCapacity);
         }
-        if (mObjects) free(mObjects);
+        if (mObjects && mObjects != mInlineObjects) {
+            arena_free(mObjects, mObjectsCapacity*sizeof(binder_size_t));
+        }
+    }
+}
+
+uint8_t* Parcel::allocData(size_t* capacity)
+{
+    // The inline buffer is free whenever mData is somewhere else.
+    if (*capacity <= sizeof(mInlineData) && mData != mInlineData) {
+        *capacity = sizeof(mInlineData);
+        return mInlineData;
+    }
+    return static_cast<uint8_t*>(arena_alloc(capacity));
+}
+
+void Parcel::releaseData(uint8_t* data, size_t capacity)
+{
+    if (data != mInlineData) arena_free(data, capacity);
+}
+
+status_t Parcel::growObjects(size_t capacity)
+{
+    binder_size_t* objects;
+    if (capacity <= INLINE_OBJECTS && mObjects != mInlineObjects) {
+        objects = mInlineObjects;
+        capacity = INLINE_OBJECTS;
+    } else {
+        size_t size = capacity*sizeof(binder_size_t);
+        if (size / sizeof(binder_size_t) != capacity) return NO_MEMORY;
+        objects = static_cast<binder_size_t*>(arena_alloc(&size));
+        if (objects == NULL) return NO_MEMORY;
+        capacity = size / sizeof(binder_size_t);
+    }
+
+    if (mObjectsSize > 0) {
+        memcpy(objects, mObjects, mObjectsSize*sizeof(binder_size_t));
     }
+    if (mObjects && mObjects != mInlineObjects) {
+        arena_free(mObjects, mObjectsCapacity*sizeof(binder_size_t));
+    }
+    mObjects = objects;
+    mObjectsCapacity = capacity;
+    return NO_ERROR;
 }
 
 status_t Parcel::growData(size_t len)
@@ -1712,31 +2146,34 @@ status_t Parcel::restartWrite(size_t desired)
         return continueWrite(desired);
     }
 
-    uint8_t* data = (uint8_t*)realloc(mData, desired);
-    if (!data && desired > mDataCapacity) {
-        mError = NO_MEMORY;
-        return NO_MEMORY;
+    // The old contents are going away, so a buffer that is already big
+    // enough is simply reused.
+    uint8_t* data = NULL;
+    size_t capacity = desired;
+    if (desired > mDataCapacity) {
+        data = allocData(&capacity);
+        if (!data) {
+            mError = NO_MEMORY;
+            return NO_MEMORY;
+        }
     }
 
     releaseObjects();
 
     if (data) {
-        LOG_ALLOC("Parcel %p: restart from %zu to %zu capacity", this, mDataCapacity, desired);
-        pthread_mutex_lock(&gParcelGlobalAllocSizeLock);
-        gParcelGlobalAllocSize += desired;
-        gParcelGlobalAllocSize -= mDataCapacity;
-        pthread_mutex_unlock(&gParcelGlobalAllocSizeLock);
+        LOG_ALLOC("Parcel %p: restart from %zu to %zu capacity", this, mDataCapacity, capacity);
+        // Counted as a new allocation only if the parcel had no buffer yet
+        alloc_stats_add((ssize_t)capacity - (ssize_t)mDataCapacity, mData ? 0 : 1);
+        if (mData) releaseData(mData, mDataCapacity);
         mData = data;
-        mDataCapacity = desired;
+        mDataCapacity = capacity;
     }
 
     mDataSize = mDataPos = 0;
     ALOGV("restartWrite Setting data size of %p to %zu", this, mDataSize);
     ALOGV("restartWrite Setting data pos of %p to %zu", this, mDataPos);
 
-    free(mObjects);
-    mObjects = NULL;
-    mObjectsSize = mObjectsCapacity = 0;
+    mObjectsSize = 0;
     mNextObjectHint = 0;
     mHasFds = false;
     mFdsKnown = true;
@@ -1777,17 +2214,26 @@ status_t Parcel::continueWrite(size_t desired)
 
         // If there is a different owner, we need to take
         // posession.
-        uint8_t* data = (uint8_t*)malloc(desired);
+        size_t capacity = desired;
+        uint8_t* data = allocData(&capacity);
         if (!data) {
             mError = NO_MEMORY;
             return NO_MEMORY;
         }
         binder_size_t* objects = NULL;
+        size_t objectsCapacity = 0;
 
         if (objectsSize) {
-            objects = (binder_size_t*)calloc(objectsSize, sizeof(binder_size_t));
+            if (objectsSize <= INLINE_OBJECTS) {
+                objects = mInlineObjects;
+                objectsCapacity = INLINE_OBJECTS;
+            } else {
+                size_t size = objectsSize*sizeof(binder_size_t);
+                objects = static_cast<binder_size_t*>(arena_alloc(&size));
+                objectsCapacity = size / sizeof(binder_size_t);
+            }
             if (!objects) {
-                free(data);
+                releaseData(data, capacity);
 
                 mError = NO_MEMORY;
                 return NO_MEMORY;
@@ -1811,18 +2257,16 @@ status_t Parcel::continueWrite(size_t desired)
         mOwner(this, mData, mDataSize, mObjects, mObjectsSize, mOwnerCookie);
         mOwner = NULL;
 
-        LOG_ALLOC("Parcel %p: taking ownership of %zu capacity", this, desired);
-        pthread_mutex_lock(&gParcelGlobalAllocSizeLock);
-        gParcelGlobalAllocSize += desired;
-        gParcelGlobalAllocCount++;
-        pthread_mutex_unlock(&gParcelGlobalAllocSizeLock);
+        LOG_ALLOC("Parcel %p: taking ownership of %zu capacity", this, capacity);
+        alloc_stats_add(capacity, 1);
 
         mData = data;
         mObjects = objects;
         mDataSize = (mDataSize < desired) ? mDataSize : desired;
         ALOGV("continueWrite Setting data size of %p to %zu", this, mDataSize);
-        mDataCapacity = desired;
-        mObjectsSize = mObjectsCapacity = objectsSize;
+        mDataCapacity = capacity;
+        mObjectsSize = objectsSize;
+        mObjectsCapacity = objectsCapacity;
         mNextObjectHint = 0;
 
     } else if (mData) {
@@ -1838,28 +2282,24 @@ status_t Parcel::continueWrite(size_t desired)
                 }
                 release_object(proc, *flat, this, &mOpenAshmemSize);
             }
-            binder_size_t* objects =
-                (binder_size_t*)realloc(mObjects, objectsSize*sizeof(binder_size_t));
-            if (objects) {
-                mObjects = objects;
-            }
+            // The objects array keeps its capacity for later writes.
             mObjectsSize = objectsSize;
             mNextObjectHint = 0;
         }
 
-        // We own the data, so we can just do a realloc().
+        // We own the data, so we can just move it to a bigger buffer.
         if (desired > mDataCapacity) {
-            uint8_t* data = (uint8_t*)realloc(mData, desired);
+            size_t capacity = desired;
+            uint8_t* data = allocData(&capacity);
             if (data) {
                 LOG_ALLOC("Parcel %p: continue from %zu to %zu capacity", this, mDataCapacity,
-                        desired);
-                pthread_mutex_lock(&gParcelGlobalAllocSizeLock);
-                gParcelGlobalAllocSize += desired;
-                gParcelGlobalAllocSize -= mDataCapacity;
-                pthread_mutex_unlock(&gParcelGlobalAllocSizeLock);
+                        capacity);
+                alloc_stats_add((ssize_t)capacity - (ssize_t)mDataCapacity, 0);
+                memcpy(data, mData, mDataCapacity);
+                releaseData(mData, mDataCapacity);
                 mData = data;
-                mDataCapacity = desired;
-            } else if (desired > mDataCapacity) {
+                mDataCapacity = capacity;
+            } else {
                 mError = NO_MEMORY;
                 return NO_MEMORY;
             }
@@ -1876,7 +2316,8 @@ status_t Parcel::continueWrite(size_t desired)
 
     } else {
         // This is the first data.  Easy!
-        uint8_t* data = (uint8_t*)malloc(desired);
+        size_t capacity = desired;
+        uint8_t* data = allocData(&capacity);
         if (!data) {
             mError = NO_MEMORY;
             return NO_MEMORY;
@@ -1887,17 +2328,14 @@ status_t Parcel::continueWrite(size_t desired)
             ALOGE("continueWrite: %zu/%p/%zu/%zu", mDataCapacity, mObjects, mObjectsCapacity, desired);
         }
 
-        LOG_ALLOC("Parcel %p: allocating with %zu capacity", this, desired);
-        pthread_mutex_lock(&gParcelGlobalAllocSizeLock);
-        gParcelGlobalAllocSize += desired;
-        gParcelGlobalAllocCount++;
-        pthread_mutex_unlock(&gParcelGlobalAllocSizeLock);
+        LOG_ALLOC("Parcel %p: allocating with %zu capacity", this, capacity);
+        alloc_stats_add(capacity, 1);
 
         mData = data;
         mDataSize = mDataPos = 0;
         ALOGV("continueWrite Setting data size of %p to %zu", this, mDataSize);
         ALOGV("continueWrite Setting data pos of %p to %zu", this, mDataPos);
-        mDataCapacity = desired;
+        mDataCapacity = capacity;
     }
 
     return NO_ERROR;
@@ -1955,7 +2393,7 @@ size_t Parcel::getOpenAshmemSize() const
 // --- Parcel::Blob ---
 
 Parcel::Blob::Blob() :
-        mFd(-1), mData(NULL), mSize(0), mMutable(false) {
+        mFd(-1), mData(NULL), mSize(0), mMutable(false), mTicket(0) {
 }
 
 Parcel::Blob::~Blob() {
@@ -1966,6 +2404,9 @@ void Parcel::Blob::release() {
     if (mFd != -1 && mData) {
         ::munmap(mData, mSize);
     }
+    if (mHeap != NULL && mData) {
+        BlobPool::release(mData, mTicket);
+    }
     clear();
 }
 
@@ -1981,6 +2422,8 @@ void Parcel::Blob::clear() {
     mData = NULL;
     mSize = 0;
     mMutable = false;
+    mHeap.clear();
+    mTicket = 0;
 }
 
 }; // namespace android
@@ -26,6 +26,7 @@
 #include <utils/Log.h>
 #include <utils/String8.h>
 #include <binder/IServiceManager.h>
+#include <binder/TransactionExecutor.h>
 #include <utils/String8.h>
 #include <utils/threads.h>
 
@@ -34,6 +35,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -163,24 +165,69 @@ bool ProcessState::becomeContextManager(context_check_func checkFunc, void* user
     return mManagesContexts;
 }
 
+ProcessState::handle_entry* ProcessState::lookupHandle(int32_t handle) const
+{
+    if (handle < 0 || (size_t)handle >= (size_t)HANDLE_CHUNKS * HANDLE_CHUNK_SIZE) {
+        return NULL;
+    }
+    handle_entry* chunk = mHandleChunks[handle >> HANDLE_CHUNK_SHIFT].load(
+            std::memory_order_acquire);
+    return chunk ? &chunk[handle & (HANDLE_CHUNK_SIZE - 1)] : NULL;
+}
+
 ProcessState::handle_entry* ProcessState::lookupHandleLocked(int32_t handle)
 {
-    const size_t N=mHandleToObject.size();
-    if (N <= (size_t)handle) {
-        handle_entry e;
-        e.binder = NULL;
-        e.refs = NULL;
-        status_t err = mHandleToObject.insertAt(e, N, handle+1-N);
-        if (err < NO_ERROR) return NULL;
+    if (handle < 0 || (size_t)handle >= (size_t)HANDLE_CHUNKS * HANDLE_CHUNK_SIZE) {
+        ALOGE("handle %d is out of range", handle);
+        return NULL;
+    }
+    std::atomic<handle_entry*>& slot = mHandleChunks[handle >> HANDLE_CHUNK_SHIFT];
+    handle_entry* chunk = slot.load(std::memory_order_relaxed);
+    if (chunk == NULL) {
+        chunk = new handle_entry[HANDLE_CHUNK_SIZE]();
+        slot.store(chunk, std::memory_order_release);
+    }
+    return &chunk[handle & (HANDLE_CHUNK_SIZE - 1)];
+}
+
+// A proxy found with only a weak reference may have no strong ones left,
+// so a strong reference is forced on it, as in getStrongProxyForHandle().
+static inline void set_proxy(sp<IBinder>* out, IBinder* b) { out->force_set(b); }
+static inline void set_proxy(wp<IBinder>* out, IBinder* b) { *out = b; }
+
+// Lock-free lookup of a live proxy, for sp<IBinder> or wp<IBinder>.  Fails
+// when there is no proxy yet or it is being destroyed; the caller then
+// takes mHandleLock and does it the slow way.
+template<typename P>
+bool ProcessState::tryGetProxyForHandle(int32_t handle, P* outProxy)
+{
+    handle_entry* e = lookupHandle(handle);
+    if (e == NULL) return false;
+
+    bool found = false;
+    e->readers.fetch_add(1, std::memory_order_seq_cst);
+    IBinder* b = e->binder.load(std::memory_order_seq_cst);
+    if (b != NULL) {
+        RefBase::weakref_type* refs = b->getWeakRefs();
+        if (refs->attemptIncWeak(this)) {
+            set_proxy(outProxy, b);
+            refs->decWeak(this);
+            found = true;
+        }
     }
-    return &mHandleToObject.editItemAt(handle);
+    e->readers.fetch_sub(1, std::memory_order_release);
+    return found;
 }
 
 sp<IBinder> ProcessState::getStrongProxyForHandle(int32_t handle)
 {
     sp<IBinder> result;
 
-    AutoMutex _l(mLock);
+    if (tryGetProxyForHandle(handle, &result)) {
+        return result;
+    }
+
+    AutoMutex _l(mHandleLock);
 
     handle_entry* e = lookupHandleLocked(handle);
 
@@ -188,8 +235,8 @@ sp<IBinder> ProcessState::getStrongProxyForHandle(int32_t handle)
         // We need to create a new BpBinder if there isn't currently one, OR we
         // are unable to acquire a weak reference on this current one.  See comment
         // in getWeakProxyForHandle() for more info about this.
-        IBinder* b = e->binder;
-        if (b == NULL || !e->refs->attemptIncWeak(this)) {
+        IBinder* b = e->binder.load(std::memory_order_relaxed);
+        if (b == NULL || !b->getWeakRefs()->attemptIncWeak(this)) {
             if (handle == 0) {
                 // Special case for context manager...
                 // The context manager is the only object for which we create
@@ -218,15 +265,14 @@ sp<IBinder> ProcessState::getStrongProxyForHandle(int32_t handle)
             }
 
             b = new BpBinder(handle); 
-            e->binder = b;
-            if (b) e->refs = b->getWeakRefs();
+            e->binder.store(b, std::memory_order_seq_cst);
             result = b;
         } else {
             // This little bit of nastyness is to allow us to add a primary
             // reference to the remote proxy when this team doesn't have one
             // but another team is sending the handle to us.
             result.force_set(b);
-            e->refs->decWeak(this);
+            b->getWeakRefs()->decWeak(this);
         }
     }
 
@@ -237,7 +283,11 @@ wp<IBinder> ProcessState::getWeakProxyForHandle(int32_t handle)
 {
     wp<IBinder> result;
 
-    AutoMutex _l(mLock);
+    if (tryGetProxyForHandle(handle, &result)) {
+        return result;
+    }
+
+    AutoMutex _l(mHandleLock);
 
     handle_entry* e = lookupHandleLocked(handle);
 
@@ -245,19 +295,19 @@ wp<IBinder> ProcessState::getWeakProxyForHandle(int32_t handle)
         // We need to create a new BpBinder if there isn't currently one, OR we
         // are unable to acquire a weak reference on this current one.  The
         // attemptIncWeak() is safe because we know the BpBinder destructor will always
-        // call expungeHandle(), which acquires the same lock we are holding now.
+        // call expungeHandle(), which acquires the same lock we are holding now
+        // (and waits out lock-free readers of the entry).
         // We need to do this because there is a race condition between someone
         // releasing a reference on this BpBinder, and a new reference on its handle
         // arriving from the driver.
-        IBinder* b = e->binder;
-        if (b == NULL || !e->refs->attemptIncWeak(this)) {
+        IBinder* b = e->binder.load(std::memory_order_relaxed);
+        if (b == NULL || !b->getWeakRefs()->attemptIncWeak(this)) {
             b = new BpBinder(handle);
             result = b;
-            e->binder = b;
-            if (b) e->refs = b->getWeakRefs();
+            e->binder.store(b, std::memory_order_seq_cst);
         } else {
             result = b;
-            e->refs->decWeak(this);
+            b->getWeakRefs()->decWeak(this);
         }
     }
 
@@ -266,14 +316,22 @@ wp<IBinder> ProcessState::getWeakProxyForHandle(int32_t handle)
 
 void ProcessState::expungeHandle(int32_t handle, IBinder* binder)
 {
-    AutoMutex _l(mLock);
+    AutoMutex _l(mHandleLock);
     
     handle_entry* e = lookupHandleLocked(handle);
+    if (e == NULL) return;
 
     // This handle may have already been replaced with a new BpBinder
     // (if someone failed the AttemptIncWeak() above); we don't want
     // to overwrite it.
-    if (e && e->binder == binder) e->binder = NULL;
+    IBinder* expected = binder;
+    e->binder.compare_exchange_strong(expected, NULL, std::memory_order_seq_cst);
+
+    // A lock-free reader may still hold the old pointer; it only needs a
+    // moment, and the proxy must outlive it.
+    while (e->readers.load(std::memory_order_seq_cst) != 0) {
+        sched_yield();
+    }
 }
 
 String8 ProcessState::makeBinderThreadName() {
@@ -304,6 +362,15 @@ status_t ProcessState::setThreadPoolMaxThreadCount(size_t maxThreads) {
     return result;
 }
 
+status_t ProcessState::enableTransactionExecutor(size_t workers) {
+    AutoMutex _l(mLock);
+    if (mExecutor.load(std::memory_order_relaxed) != NULL) {
+        return INVALID_OPERATION;
+    }
+    mExecutor.store(new TransactionExecutor(workers), std::memory_order_release);
+    return NO_ERROR;
+}
+
 void ProcessState::giveThreadPoolName() {
     androidSetThreadName( makeBinderThreadName().string() );
 }
@@ -343,11 +410,13 @@ ProcessState::ProcessState()
     , mThreadCountDecrement(PTHREAD_COND_INITIALIZER)
     , mExecutingThreadsCount(0)
     , mMaxThreads(DEFAULT_MAX_BINDER_THREADS)
+    , mHandleChunks()
     , mManagesContexts(false)
     , mBinderContextCheckFunc(NULL)
     , mBinderContextUserData(NULL)
     , mThreadPoolStarted(false)
     , mThreadPoolSeq(1)
+    , mExecutor(NULL)
 {
     if (mDriverFD >= 0) {
         // XXX Ideally, there should be a specific define for whether we
@@ -372,6 +441,10 @@ ProcessState::ProcessState()
 
 ProcessState::~ProcessState()
 {
+    for (size_t i = 0; i < HANDLE_CHUNKS; i++) {
+        delete[] mHandleChunks[i].load(std::memory_order_relaxed);
+    }
+    delete mExecutor.load(std::memory_order_relaxed);
 }
         
 }; // namespace android
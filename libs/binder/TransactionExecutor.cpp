@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "TransactionExecutor"
+
+#include <binder/TransactionExecutor.h>
+
+#include <utils/Log.h>
+#include <utils/String8.h>
+
+#include <sched.h>
+#include <unistd.h>
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+static size_t online_cpus()
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (size_t) cpus : 1;
+}
+
+class TransactionExecutor::Worker : public Thread
+{
+public:
+    Worker(TransactionExecutor* executor, size_t index)
+        : Thread(false), mExecutor(executor), mIndex(index)
+    {
+    }
+
+protected:
+    virtual bool threadLoop()
+    {
+        return mExecutor->runOne(mIndex);
+    }
+
+private:
+    TransactionExecutor* const mExecutor;
+    const size_t        mIndex;
+};
+
+TransactionExecutor::TransactionExecutor(size_t workers)
+    : mCount(workers ? workers : online_cpus()),
+      mQueues(new queue_t[mCount]),
+      mNextQueue(0),
+      mPending(0),
+      mSleepers(0),
+      mExiting(false),
+      mWorkers(new sp<Thread>[mCount])
+{
+    for (size_t i = 0; i < mCount; i++) {
+        mWorkers[i] = new Worker(this, i);
+        mWorkers[i]->run(String8::format("BinderWorker_%zu", i).string());
+    }
+}
+
+TransactionExecutor::~TransactionExecutor()
+{
+    {
+        AutoMutex _l(mIdleLock);
+        mExiting = true;
+        mIdle.broadcast();
+    }
+    for (size_t i = 0; i < mCount; i++) {
+        mWorkers[i]->requestExitAndWait();
+    }
+    delete[] mWorkers;
+    delete[] mQueues;
+}
+
+void TransactionExecutor::submit(const Task& task)
+{
+    int cpu = sched_getcpu();
+    size_t index = cpu >= 0 ? (size_t) cpu % mCount : mNextQueue++ % mCount;
+    {
+        AutoMutex _l(mQueues[index].lock);
+        mQueues[index].tasks.push_back(task);
+    }
+
+    AutoMutex _l(mIdleLock);
+    mPending++;
+    if (mSleepers > 0) {
+        mIdle.signal();
+    }
+}
+
+bool TransactionExecutor::take(size_t self, Task* outTask)
+{
+    for (size_t n = 0; n < mCount; n++) {
+        queue_t& queue = mQueues[(self + n) % mCount];
+        AutoMutex _l(queue.lock);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        // Our own queue in order, someone else's from the back.
+        if (n == 0) {
+            *outTask = queue.tasks.front();
+            queue.tasks.pop_front();
+        } else {
+            *outTask = queue.tasks.back();
+            queue.tasks.pop_back();
+        }
+        mPending--;
+        return true;
+    }
+    return false;
+}
+
+bool TransactionExecutor::runOne(size_t self)
+{
+    Task task;
+    if (take(self, &task)) {
+        task();
+        return true;
+    }
+
+    AutoMutex _l(mIdleLock);
+    while (mPending == 0 && !mExiting) {
+        mSleepers++;
+        mIdle.wait(mIdleLock);
+        mSleepers--;
+    }
+    return !mExiting;
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
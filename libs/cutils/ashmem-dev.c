@@ -16,8 +16,8 @@
 
 /*
  * Implementation of the user-space ashmem API for devices, which have our
- * ashmem-enabled kernel. See ashmem-sim.c for the "fake" tmp-based version,
- * used by the simulator.
+ * ashmem-enabled kernel. Without /dev/ashmem every call is forwarded to the
+ * memfd-based version in ashmem-host.c.
  */
 
 #include <unistd.h>
@@ -26,14 +26,32 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 typedef unsigned int __u32;
 
 #include <driver/ashmem/uapi_ashmem.h>
 #include <cutils/ashmem.h>
 
+#include "ashmem-host.h"
+
 #define ASHMEM_DEVICE	"/dev/ashmem"
 
+static pthread_once_t ashmem_once = PTHREAD_ONCE_INIT;
+static int ashmem_has_device;
+
+static void ashmem_probe_device(void)
+{
+	ashmem_has_device = access(ASHMEM_DEVICE, F_OK) == 0;
+}
+
+/* whether to use the driver, decided once per process */
+static int ashmem_use_device(void)
+{
+	pthread_once(&ashmem_once, ashmem_probe_device);
+	return ashmem_has_device;
+}
+
 /*
  * ashmem_create_region - creates a new ashmem region and returns the file
  * descriptor, or <0 on error
@@ -45,6 +63,9 @@ int ashmem_create_region(const char *name, size_t size)
 {
 	int fd, ret;
 
+	if (!ashmem_use_device())
+		return ashmem_host_create_region(name, size);
+
 	fd = open(ASHMEM_DEVICE, O_RDWR);
 	if (fd < 0)
 		return fd;
@@ -71,22 +92,32 @@ error:
 
 int ashmem_set_prot_region(int fd, int prot)
 {
+	if (!ashmem_use_device())
+		return ashmem_host_set_prot_region(fd, prot);
 	return ioctl(fd, ASHMEM_SET_PROT_MASK, prot);
 }
 
 int ashmem_pin_region(int fd, size_t offset, size_t len)
 {
 	struct ashmem_pin pin = { offset, len };
+
+	if (!ashmem_use_device())
+		return ashmem_host_pin_region(fd, offset, len);
 	return ioctl(fd, ASHMEM_PIN, &pin);
 }
 
 int ashmem_unpin_region(int fd, size_t offset, size_t len)
 {
 	struct ashmem_pin pin = { offset, len };
+
+	if (!ashmem_use_device())
+		return ashmem_host_unpin_region(fd, offset, len);
 	return ioctl(fd, ASHMEM_UNPIN, &pin);
 }
 
 int ashmem_get_size_region(int fd)
 {
+  if (!ashmem_use_device())
+    return ashmem_host_get_size_region(fd);
   return ioctl(fd, ASHMEM_GET_SIZE, NULL);
 }
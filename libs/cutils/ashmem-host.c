@@ -15,30 +15,84 @@
  */
 
 /*
- * Implementation of the user-space ashmem API for the simulator, which lacks
- * an ashmem-enabled kernel. See ashmem-dev.c for the real ashmem-based version.
+ * Implementation of the user-space ashmem API for kernels without the
+ * ashmem driver. See ashmem-dev.c for the real ashmem-based version, which
+ * forwards here when /dev/ashmem is missing.
+ *
+ * Regions are memfds, so they never touch a filesystem:
+ *  - the size is sealed at creation, as ashmem fixes it at first mmap;
+ *  - dropping PROT_WRITE seals the memfd against future writable mappings;
+ *  - unpinning punches the pages out right away and remembers the range,
+ *    and pinning reports ASHMEM_WAS_PURGED if it overlaps such a range.
+ *
+ * Unlike ashmem, unpinned pages are discarded immediately rather than
+ * under memory pressure: there is no way to hand file pages to reclaim
+ * and learn later whether they went (MADV_FREE only works on anonymous
+ * memory), so a pin after an unpin always reports a purge, and callers
+ * rebuild contents ashmem would usually have kept. Only ranges unpinned
+ * through this process are known; a range that cannot be punched, as
+ * once PROT_WRITE is dropped, is kept and not reported as purged.
  */
 
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <linux/falloc.h>
+#include <linux/memfd.h>
+
 #include <cutils/ashmem.h>
 #include <utils/Compat.h>
 
-#ifndef __unused
-#define __unused __attribute__((__unused__))
+#include "ashmem-host.h"
+
+#ifndef F_ADD_SEALS
+#define F_LINUX_SPECIFIC_BASE	1024
+#define F_ADD_SEALS		(F_LINUX_SPECIFIC_BASE + 9)
+#define F_GET_SEALS		(F_LINUX_SPECIFIC_BASE + 10)
+#define F_SEAL_SEAL		0x0001
+#define F_SEAL_SHRINK		0x0002
+#define F_SEAL_GROW		0x0004
+#define F_SEAL_WRITE		0x0008
+#endif
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE	0x0010
 #endif
 
-int ashmem_create_region(const char *ignored __unused, size_t size)
+static int memfd_create_region(const char *name, size_t size)
+{
+#ifdef __NR_memfd_create
+    int fd = syscall(__NR_memfd_create, name ? name : ASHMEM_NAME_DEF,
+                     MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        return -1;
+    }
+    if (TEMP_FAILURE_RETRY(ftruncate(fd, size)) == -1 ||
+            fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int tmpfile_create_region(size_t size)
 {
     char template[PATH_MAX];
     snprintf(template, sizeof(template), "/tmp/android-ashmem-%d-XXXXXXXXX", getpid());
@@ -50,22 +104,165 @@ int ashmem_create_region(const char *ignored __unused, size_t size)
     return -1;
 }
 
-int ashmem_set_prot_region(int fd __unused, int prot __unused)
+int ashmem_host_create_region(const char *name, size_t size)
 {
+    int fd = memfd_create_region(name, size);
+    if (fd == -1 && (errno == ENOSYS || errno == EINVAL)) {
+        fd = tmpfile_create_region(size);
+    }
+    return fd;
+}
+
+/* A range punched out by unpin, until it is pinned again */
+struct unpinned_range {
+    dev_t dev;
+    ino_t ino;
+    size_t offset;
+    size_t len;
+    struct unpinned_range *next;
+};
+
+static pthread_mutex_t unpinned_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct unpinned_range *unpinned_ranges;
+
+static int add_unpinned(const struct stat *st, size_t offset, size_t len)
+{
+    struct unpinned_range *range = malloc(sizeof(*range));
+    if (range == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    range->dev = st->st_dev;
+    range->ino = st->st_ino;
+    range->offset = offset;
+    range->len = len;
+
+    pthread_mutex_lock(&unpinned_lock);
+    range->next = unpinned_ranges;
+    unpinned_ranges = range;
+    pthread_mutex_unlock(&unpinned_lock);
     return 0;
 }
 
-int ashmem_pin_region(int fd __unused, size_t offset __unused, size_t len __unused)
+/*
+ * Forgets the unpinned ranges of the region overlapping [offset, end),
+ * keeping the parts outside it. Returns whether there were any, or -1.
+ */
+static int remove_unpinned(const struct stat *st, size_t offset, size_t end)
 {
-    return ASHMEM_NOT_PURGED;
+    struct unpinned_range **link, *range;
+    int purged = 0;
+
+    pthread_mutex_lock(&unpinned_lock);
+    for (link = &unpinned_ranges; (range = *link) != NULL; ) {
+        size_t range_end = range->offset + range->len;
+        if (range->dev != st->st_dev || range->ino != st->st_ino ||
+                range_end <= offset || range->offset >= end) {
+            link = &range->next;
+            continue;
+        }
+        purged = 1;
+        if (range->offset < offset && range_end > end) {
+            // The pinned range splits this one in two
+            struct unpinned_range *tail = malloc(sizeof(*tail));
+            if (tail == NULL) {
+                pthread_mutex_unlock(&unpinned_lock);
+                errno = ENOMEM;
+                return -1;
+            }
+            *tail = *range;
+            tail->offset = end;
+            tail->len = range_end - end;
+            range->len = offset - range->offset;
+            range->next = tail;
+            link = &tail->next;
+        } else if (range->offset < offset) {
+            range->len = offset - range->offset;
+            link = &range->next;
+        } else if (range_end > end) {
+            range->offset = end;
+            range->len = range_end - end;
+            link = &range->next;
+        } else {
+            *link = range->next;
+            free(range);
+        }
+    }
+    pthread_mutex_unlock(&unpinned_lock);
+    return purged;
 }
 
-int ashmem_unpin_region(int fd __unused, size_t offset __unused, size_t len __unused)
+int ashmem_host_set_prot_region(int fd, int prot)
 {
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals == -1) {
+        return 0;  // Not a memfd: nothing we can enforce
+    }
+
+    if (prot & PROT_WRITE) {
+        // The protection can only be narrowed, as with ashmem
+        if (seals & (F_SEAL_FUTURE_WRITE | F_SEAL_WRITE)) {
+            errno = EINVAL;
+            return -1;
+        }
+        return 0;
+    }
+
+    // F_SEAL_FUTURE_WRITE leaves existing writable mappings alone, like
+    // ASHMEM_SET_PROT_MASK does. Older kernels only have F_SEAL_WRITE,
+    // which fails with EBUSY while such a mapping exists; that error is
+    // returned, as the region would otherwise stay writable.
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE) == -1 &&
+            fcntl(fd, F_ADD_SEALS, F_SEAL_WRITE) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+int ashmem_host_pin_region(int fd, size_t offset, size_t len)
+{
+    struct stat buf;
+    if (fstat(fd, &buf) == -1) {
+        return -1;
+    }
+    if (len == 0) {
+        len = buf.st_size - offset;
+    }
+
+    int purged = remove_unpinned(&buf, offset, offset + len);
+    if (purged == -1) {
+        return -1;
+    }
+    return purged ? ASHMEM_WAS_PURGED : ASHMEM_NOT_PURGED;
+}
+
+int ashmem_host_unpin_region(int fd, size_t offset, size_t len)
+{
+    struct stat buf;
+    if (fstat(fd, &buf) == -1) {
+        return -1;
+    }
+    if (len == 0) {
+        len = buf.st_size - offset;
+    }
+
+    // Same effect as MADV_REMOVE on a mapping of the range. A write seal
+    // refuses it with EPERM, and some filesystems under a tmpfile region
+    // cannot punch holes; the pages are then simply kept.
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  offset, len) == -1) {
+        if (errno == EPERM || errno == EOPNOTSUPP) {
+            return ASHMEM_IS_UNPINNED;
+        }
+        return -1;
+    }
+    if (add_unpinned(&buf, offset, len) == -1) {
+        return -1;
+    }
     return ASHMEM_IS_UNPINNED;
 }
 
-int ashmem_get_size_region(int fd)
+int ashmem_host_get_size_region(int fd)
 {
     struct stat buf;
     int result = fstat(fd, &buf);
@@ -73,6 +270,11 @@ int ashmem_get_size_region(int fd)
         return -1;
     }
 
+    // A memfd is recognised by supporting seals.
+    if (fcntl(fd, F_GET_SEALS) != -1) {
+        return buf.st_size;
+    }
+
     // Check if this is an "ashmem" region.
     // TODO: This is very hacky, and can easily break. We need some reliable indicator.
     if (!(buf.st_nlink == 0 && S_ISREG(buf.st_mode))) {
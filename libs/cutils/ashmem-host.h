@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ASHMEM_HOST_H
+#define __ASHMEM_HOST_H
+
+#include <stddef.h>
+
+/*
+ * The ashmem API implemented without the ashmem driver, on memfd (or on
+ * an unlinked file in /tmp when the kernel has no memfd_create).
+ * ashmem-dev.c forwards to these when /dev/ashmem does not exist.
+ */
+int ashmem_host_create_region(const char *name, size_t size);
+int ashmem_host_set_prot_region(int fd, int prot);
+int ashmem_host_pin_region(int fd, size_t offset, size_t len);
+int ashmem_host_unpin_region(int fd, size_t offset, size_t len);
+int ashmem_host_get_size_region(int fd);
+
+#endif
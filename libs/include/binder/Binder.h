@@ -57,6 +57,13 @@ public:
 
     virtual BBinder*    localBinder();
 
+            // Lets BpBinder::transactAsync() callers reach this object.  Off
+            // by default, since an async call makes this object send the
+            // reply to a binder of the caller's choosing; turn it on before
+            // the object is handed out.
+            void        setAsyncCallsEnabled(bool enabled);
+            bool        asyncCallsEnabled() const;
+
 protected:
     virtual             ~BBinder();
 
@@ -72,6 +79,7 @@ private:
     class Extras;
 
     std::atomic<uintptr_t>   mExtras;  // should be atomic<Extras *>
+    std::atomic<bool>        mAsyncCalls;
             void*       mReserved0;
 };
 
@@ -89,6 +97,11 @@ protected:
     inline  IBinder*        remote()                { return mRemote; }
     inline  IBinder*        remote() const          { return mRemote; }
 
+    // Sizes data for a request with this code to remote(), when that is a
+    // proxy with size prediction on; see BpBinder::setSizePrediction().
+    // Call it before writing the request.
+            void            reserveRequest(uint32_t code, Parcel* data) const;
+
 private:
                             BpRefBase(const BpRefBase& o);
     BpRefBase&              operator=(const BpRefBase& o);
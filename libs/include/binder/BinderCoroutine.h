@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_BINDER_COROUTINE_H
+#define ANDROID_BINDER_COROUTINE_H
+
+/*
+ * co_await support for binder calls, on top of BpBinder::transactAsync().
+ *
+ * A coroutine returning BinderTask<T> can co_await awaitTransact() on any
+ * binder, or another BinderTask such as an async method of a BpInterface.
+ * While a call is in flight the coroutine holds no thread; when the reply
+ * arrives an AwaitExecutor resumes it, either right on the binder thread
+ * that received the reply or on a Looper thread.  Start a top-level task
+ * with spawn().  Targets must support transactAsync(); see BpBinder.h.
+ *
+ * This header is only usable from C++20 code; libbinder itself does not
+ * depend on it.
+ */
+
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+#include <binder/BpBinder.h>
+#include <binder/Parcel.h>
+#include <utils/Looper.h>
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+// Where a coroutine continues once the call it awaits completes.  An
+// executor must outlive every call awaited with it.
+class AwaitExecutor
+{
+public:
+    virtual             ~AwaitExecutor() { }
+    virtual void        resume(std::coroutine_handle<> handle) = 0;
+};
+
+// Resumes on the binder thread that received the reply.  The coroutine
+// then runs on the thread pool until its next co_await, so it must not
+// block there for long.
+class BinderPoolExecutor : public AwaitExecutor
+{
+public:
+    virtual void        resume(std::coroutine_handle<> handle) { handle.resume(); }
+
+    static BinderPoolExecutor* get()
+    {
+        static BinderPoolExecutor executor;
+        return &executor;
+    }
+};
+
+// Resumes from the message queue of a Looper, on the thread polling it.
+class LooperExecutor : public AwaitExecutor
+{
+public:
+    explicit            LooperExecutor(const sp<Looper>& looper) : mLooper(looper) { }
+
+    virtual void        resume(std::coroutine_handle<> handle)
+    {
+        mLooper->sendMessage(new Resumer(handle), Message());
+    }
+
+private:
+    class Resumer : public MessageHandler
+    {
+    public:
+        explicit        Resumer(std::coroutine_handle<> handle) : mHandle(handle) { }
+        virtual void    handleMessage(const Message&) { mHandle.resume(); }
+
+    private:
+        std::coroutine_handle<> mHandle;
+    };
+
+    sp<Looper>          mLooper;
+};
+
+// ----------------------------------------------------------------------------
+
+// Awaitable for one call; co_await yields the call's status.  Calls on a
+// local binder run synchronously without suspending.
+class TransactAwaiter
+{
+public:
+    TransactAwaiter(const sp<IBinder>& binder, uint32_t code, const Parcel& data,
+                    Parcel* reply, AwaitExecutor* executor)
+        : mBinder(binder), mCode(code), mData(data), mReply(reply),
+          mExecutor(executor), mStatus(NO_ERROR) { }
+
+    bool await_ready()
+    {
+        if (mBinder == NULL) {
+            mStatus = BAD_VALUE;
+            return true;
+        }
+        if (mBinder->remoteBinder() == NULL) {
+            mStatus = mBinder->transact(mCode, mData, mReply);
+            return true;
+        }
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        // The reply may come back before transactAsync() returns, so
+        // nothing here may touch this awaiter after a successful send.
+        status_t err = mBinder->remoteBinder()->transactAsync(mCode, mData,
+                [this, handle](status_t status, const Parcel& reply) {
+                    if (mReply != NULL) {
+                        mReply->appendFrom(&reply, reply.dataPosition(),
+                                           reply.dataAvail());
+                        mReply->setDataPosition(0);
+                    }
+                    mStatus = status;
+                    mExecutor->resume(handle);
+                });
+        if (err != NO_ERROR) {
+            mStatus = err;
+            return false;
+        }
+        return true;
+    }
+
+    status_t await_resume() const { return mStatus; }
+
+private:
+    sp<IBinder>         mBinder;
+    const uint32_t      mCode;
+    const Parcel&       mData;
+    Parcel*             mReply;
+    AwaitExecutor*      mExecutor;
+    status_t            mStatus;
+};
+
+inline TransactAwaiter awaitTransact(const sp<IBinder>& binder, uint32_t code,
+        const Parcel& data, Parcel* reply,
+        AwaitExecutor* executor = BinderPoolExecutor::get())
+{
+    return TransactAwaiter(binder, code, data, reply, executor);
+}
+
+// ----------------------------------------------------------------------------
+
+class BinderTaskPromiseBase
+{
+public:
+    // Hands control back to whoever awaited the task, if anyone.
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template<typename PROMISE>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<PROMISE> handle) noexcept
+        {
+            std::coroutine_handle<> next = handle.promise().mContinuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() noexcept { }
+    };
+
+    std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+    FinalAwaiter        final_suspend() noexcept { return FinalAwaiter(); }
+    void                unhandled_exception() { std::terminate(); }
+
+    std::coroutine_handle<> mContinuation;
+};
+
+template<typename T>
+class BinderTaskPromise : public BinderTaskPromiseBase
+{
+public:
+    void                return_value(T value) { mValue = std::move(value); }
+    T                   result() { return std::move(mValue); }
+
+private:
+    T                   mValue;
+};
+
+template<>
+class BinderTaskPromise<void> : public BinderTaskPromiseBase
+{
+public:
+    void                return_void() { }
+    void                result() { }
+};
+
+// A lazily started coroutine producing a T.  It runs when first awaited,
+// and the awaiting coroutine continues when it finishes.
+template<typename T = void>
+class BinderTask
+{
+public:
+    struct promise_type : public BinderTaskPromise<T> {
+        BinderTask get_return_object()
+        {
+            return BinderTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+    };
+
+    BinderTask(BinderTask&& other) noexcept
+        : mHandle(std::exchange(other.mHandle, nullptr)) { }
+    ~BinderTask() { if (mHandle) mHandle.destroy(); }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+        mHandle.promise().mContinuation = caller;
+        return mHandle;
+    }
+    T await_resume() { return mHandle.promise().result(); }
+
+private:
+    explicit BinderTask(std::coroutine_handle<promise_type> handle) : mHandle(handle) { }
+    BinderTask(const BinderTask&);
+    BinderTask& operator=(const BinderTask&);
+
+    std::coroutine_handle<promise_type> mHandle;
+};
+
+// A coroutine nobody awaits; its frame goes away when it finishes.
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask        get_return_object() { return DetachedTask(); }
+        std::suspend_never  initial_suspend() noexcept { return std::suspend_never(); }
+        std::suspend_never  final_suspend() noexcept { return std::suspend_never(); }
+        void                return_void() { }
+        void                unhandled_exception() { std::terminate(); }
+    };
+};
+
+// Runs task on the calling thread until its first suspension and lets it
+// finish on its own.  Any result is dropped.
+template<typename T>
+DetachedTask spawn(BinderTask<T> task)
+{
+    co_await task;
+}
+
+// ----------------------------------------------------------------------------
+}; // namespace android
+
+#endif // __cplusplus >= 202002L
+
+#endif // ANDROID_BINDER_COROUTINE_H
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_BLOB_POOL_H
+#define ANDROID_BLOB_POOL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <binder/IMemory.h>
+#include <binder/MemoryDealer.h>
+#include <utils/threads.h>
+#include <utils/Vector.h>
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+/*
+ * A persistent shared-memory pool for Parcel blobs.
+ *
+ * Large blobs written to a parcel that has a pool set are placed in a
+ * chunk of the pool and sent as the pool's heap plus an offset, instead
+ * of in a new ashmem region each.  The receiver maps the heap the first
+ * time it sees it and keeps the mapping for later blobs.  Each chunk
+ * starts with a busy word holding the ticket the chunk was handed out
+ * with, which is also sent with the blob.  The receiver clears it when
+ * it releases its ReadableBlob or frees the parcel, and the sender when
+ * the transaction fails; after that the sender reuses the chunk.  A blob
+ * that was not read is only released if the receiver has already mapped
+ * its pool, since freeing a parcel must not make calls; a receiver that
+ * never reads pool blobs fills the pool, and later blobs fall back to a
+ * region of their own.  Clearing only matches the same ticket,
+ * so a late second release cannot free the chunk's next use.  Chunks
+ * are kept mapped and populated across reuse.
+ *
+ * The heap stays writable by both sides, so like a mutable ashmem blob,
+ * the receiver must copy anything it validates before acting on it.
+ */
+class BlobPool : public RefBase
+{
+public:
+    enum {
+        // Bytes in front of each chunk's data, holding the busy word.
+        HEADER_SIZE = 32,
+    };
+
+    explicit BlobPool(size_t size, const char* name = "BlobPool");
+
+    // Returns the data of a chunk with room for len bytes and marks it
+    // busy, or NULL when the pool is full.  *outOffset is the data's
+    // offset in heap() and *outTicket what release() takes.
+    void*               acquire(size_t len, size_t* outOffset, uint32_t* outTicket);
+
+    sp<IMemoryHeap>     heap() const;
+
+    // Chunks handed out and not yet released by their reader.
+    size_t              busyCount() const;
+
+    // Reader side: the mapping of a pool heap received in a parcel.
+    // Mappings are cached, so only the first blob from a pool maps it.
+    static sp<IMemoryHeap> mapHeap(const sp<IBinder>& binder);
+
+    // Like mapHeap(), but only finds a heap of this process or one that
+    // is already mapped, and never makes a call.
+    static sp<IMemoryHeap> findHeap(const sp<IBinder>& binder);
+
+    // Hands the chunk holding data back to its pool, if it is still
+    // busy with ticket.
+    static void         release(void* data, uint32_t ticket);
+
+protected:
+    virtual ~BlobPool();
+
+private:
+    struct chunk_t {
+        sp<IMemory> memory;
+        uint8_t*    base;
+        size_t      size;
+    };
+
+    void                reclaim();
+
+    mutable Mutex       mLock;
+    sp<MemoryDealer>    mDealer;
+    uint32_t            mNextTicket;
+    Vector<chunk_t>     mBusy;
+    Vector<chunk_t>     mFree;
+};
+
+// ----------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_BLOB_POOL_H
@@ -17,6 +17,10 @@
 #ifndef ANDROID_BPBINDER_H
 #define ANDROID_BPBINDER_H
 
+#include <atomic>
+#include <functional>
+#include <future>
+
 #include <binder/IBinder.h>
 #include <utils/KeyedVector.h>
 #include <utils/threads.h>
@@ -24,6 +28,8 @@
 // ---------------------------------------------------------------------------
 namespace android {
 
+class BlobPool;
+
 class BpBinder : public IBinder
 {
 public:
@@ -61,6 +67,49 @@ public:
             status_t    setConstantData(const void* data, size_t size);
             void        sendObituary();
 
+            // Request size prediction, off by default.  When enabled,
+            // transact() remembers how big the last request with each code
+            // was, and reserveRequest() sizes a new request parcel for
+            // that code up front so building it never has to regrow.
+            // Proxies call it through BpRefBase::reserveRequest().
+            void        setSizePrediction(bool enabled);
+            status_t    reserveRequest(uint32_t code, Parcel* data) const;
+
+            // Whether a reply from the target has said it understands
+            // compact interface tokens; see Parcel::writeInterfaceToken().
+            bool        acceptsCompactInterfaceTokens() const
+                        { return mCompactTokens.load(std::memory_order_relaxed); }
+
+            // Shared-memory pool for large blobs sent to this object,
+            // created with the given size on first use.  Hand it to
+            // Parcel::setBlobPool() before writing blobs; the receiver
+            // maps it once and returns chunks as it releases them.
+            enum { DEFAULT_BLOB_POOL_SIZE = 4 * 1024 * 1024 };
+            sp<BlobPool> getBlobPool(size_t size = DEFAULT_BLOB_POOL_SIZE);
+
+            // Two-way call that does not block the calling thread.  The
+            // request goes out as a oneway transaction carrying a reply
+            // binder made for this call, the target runs it as an ordinary
+            // call and sends the reply back the same way.  done then runs on a binder thread
+            // of this process, so the thread pool must be started.  If the
+            // target dies first, done gets DEAD_OBJECT and an empty parcel.
+            // Oneway calls to one object are delivered in order, so calls
+            // only overlap when they go to different objects.  done runs
+            // exactly once if this returns NO_ERROR, and never otherwise.
+            // The target must have called
+            // BBinder::setAsyncCallsEnabled(): any other object, as well as
+            // one in a process built without this support, drops
+            // ASYNC_CALL_TRANSACTION as an unknown oneway call and done
+            // never runs, so only use this with targets known to take it.
+            typedef std::function<void(status_t, const Parcel&)> AsyncReplyFunc;
+            status_t    transactAsync(uint32_t code, const Parcel& data,
+                                      const AsyncReplyFunc& done);
+
+            // Same, with the call's status as a future.  reply is filled
+            // in before the future is ready, so it must outlive it.
+            std::future<status_t> transactAsync(uint32_t code, const Parcel& data,
+                                                Parcel* reply);
+
     class ObjectManager
     {
     public:
@@ -115,6 +164,16 @@ private:
             ObjectManager       mObjects;
             Parcel*             mConstantData;
     mutable String16            mDescriptorCache;
+
+    // Last request size by code, as (code << 32) | size.  Codes that
+    // share a slot simply replace each other.
+    enum { SIZE_HINTS = 16 };
+            std::atomic<bool>   mSizePrediction;
+            std::atomic<uint64_t> mSizeHints[SIZE_HINTS];
+
+            sp<BlobPool>        mBlobPool;
+            std::atomic<bool>   mAsyncLinked;
+            std::atomic<bool>   mCompactTokens;
 };
 
 }; // namespace android
@@ -52,6 +52,8 @@ public:
         DUMP_TRANSACTION        = B_PACK_CHARS('_','D','M','P'),
         INTERFACE_TRANSACTION   = B_PACK_CHARS('_', 'N', 'T', 'F'),
         SYSPROPS_TRANSACTION    = B_PACK_CHARS('_', 'S', 'P', 'R'),
+        // A call made with BpBinder::transactAsync(), see BBinder::transact().
+        ASYNC_CALL_TRANSACTION  = B_PACK_CHARS('_', 'A', 'S', 'C'),
 
         // Corresponds to TF_ONE_WAY -- an asynchronous call.
         FLAG_ONEWAY             = 0x00000001
@@ -32,7 +32,9 @@ namespace android {
 class IPCThreadState
 {
 public:
-    static  IPCThreadState*     self();
+    // Inline, since every transaction and freed reply looks it up; the
+    // pthread key only serves to destroy the state when the thread exits.
+    inline static IPCThreadState* self();
     static  IPCThreadState*     selfOrNull();  // self(), but won't instantiate
     
             sp<ProcessState>    process();
@@ -48,10 +50,19 @@ public:
             void                setLastTransactionBinderFlags(int32_t flags);
             int32_t             getLastTransactionBinderFlags() const;
 
+            // Flags of the reply to this thread's last transact(), or 0
+            // for a oneway call or one that got no reply.
+            uint32_t            getLastReplyFlags() const { return mLastReplyFlags; }
+
             int64_t             clearCallingIdentity();
             void                restoreCallingIdentity(int64_t token);
             
-            int                 setupPolling(int* fd);
+            // With exclusive set, each polling thread gets its own wakeups
+            // and the driver wakes only one of them per incoming command,
+            // so several threads can poll the same binder fd.  Exclusive
+            // pollers also read without blocking, so handlePolledCommands()
+            // keeps going until the driver has no work left for them.
+            int                 setupPolling(int* fd, bool exclusive = false);
             status_t            handlePolledCommands();
             void                flushCommands();
 
@@ -88,6 +99,18 @@ public:
             // the maximum number of binder threads threads allowed for this process.
             void                blockUntilThreadAvailable();
 
+            // Counters of this thread's traffic with the driver, for
+            // working out system calls per transaction.
+            struct DriverStats {
+                uint64_t        writeReads;       // BINDER_WRITE_READ calls
+                uint64_t        commandsIn;       // BR_ commands processed
+                uint64_t        transactionsOut;  // BC_TRANSACTIONs sent
+                uint64_t        transactionsIn;   // BR_TRANSACTIONs executed
+                uint64_t        refsCoalesced;    // handle ref commands not sent
+            };
+            const DriverStats&  getDriverStats() const { return mDriverStats; }
+            void                resetDriverStats();
+
 private:
                                 IPCThreadState();
                                 ~IPCThreadState();
@@ -104,10 +127,16 @@ private:
                                                      status_t* statusBuffer);
             status_t            getAndExecuteCommand();
             status_t            executeCommand(int32_t command);
+            void                executeOneway(const binder_transaction_data& tr);
             void                processPendingDerefs();
+            void                consumeOutput(size_t consumed);
+            void                addPendingRef(int32_t handle,
+                                              int32_t strong, int32_t weak);
+            void                writePendingRefs();
 
             void                clearCaller();
 
+    static  IPCThreadState*     selfSlow();
     static  void                threadDestructor(void *st);
     static  void                freeBuffer(Parcel* parcel,
                                            const uint8_t* data, size_t dataSize,
@@ -121,13 +150,40 @@ private:
 
             Parcel              mIn;
             Parcel              mOut;
+            size_t              mOutConsumed;
+            // Net ref count changes to remote handles not yet written to
+            // mOut.  They go out ahead of the next command that could
+            // depend on them, so a proxy made and dropped in between
+            // costs the driver nothing.
+            struct PendingRef {
+                int32_t         handle;
+                int32_t         strong;
+                int32_t         weak;
+            };
+            static const size_t kMaxPendingRefs = 8;
+            PendingRef          mPendingRefs[kMaxPendingRefs];
+            size_t              mPendingRefCount;
+            DriverStats         mDriverStats;
             status_t            mLastError;
             pid_t               mCallingPid;
             uid_t               mCallingUid;
             int32_t             mStrictModePolicy;
             int32_t             mLastTransactionBinderFlags;
+            uint32_t            mLastReplyFlags;
+            bool                mExclusivePoll;
+            // The SchedPolicy this thread was last put in here, or
+            // SP_DEFAULT before the first command.
+            int32_t             mSchedPolicy;
+
+    static  thread_local IPCThreadState* sSelf;
 };
 
+inline IPCThreadState* IPCThreadState::self()
+{
+    IPCThreadState* st = sSelf;
+    return st != NULL ? st : selfSlow();
+}
+
 }; // namespace android
 
 // ---------------------------------------------------------------------------
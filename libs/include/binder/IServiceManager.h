@@ -43,6 +43,11 @@ public:
      */
     virtual sp<IBinder>         checkService( const String16& name) const = 0;
 
+    /**
+     * Retrieve a service, blocking until it is registered.
+     */
+    virtual sp<IBinder>         waitForService( const String16& name);
+
     /**
      * Register a service.
      */
@@ -60,9 +65,22 @@ public:
         CHECK_SERVICE_TRANSACTION,
         ADD_SERVICE_TRANSACTION,
         LIST_SERVICES_TRANSACTION,
+        NOTIFY_SERVICE_TRANSACTION,
+        CANCEL_NOTIFY_TRANSACTION,
+    };
+
+    // Sent oneway to the binder passed with NOTIFY_SERVICE_TRANSACTION
+    // once the service it asked about is registered.
+    enum {
+        SERVICE_REGISTERED_TRANSACTION = IBinder::FIRST_CALL_TRANSACTION,
     };
 };
 
+// The manager returned caches the services it finds, until they die.
+// A service replaced while its old binder is still alive is only seen
+// after that binder dies or fails a call.  Waiting for a service is woken
+// by servicemanager, which needs a thread reading from the driver, such as
+// the thread pool; without one it falls back to checking once a second.
 sp<IServiceManager> defaultServiceManager();
 
 template<typename INTERFACE>
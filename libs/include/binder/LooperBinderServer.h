@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_LOOPER_BINDER_SERVER_H
+#define ANDROID_LOOPER_BINDER_SERVER_H
+
+#include <utils/Errors.h>
+#include <utils/Looper.h>
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+/*
+ * Serves incoming binder calls from a Looper instead of a thread pool.
+ *
+ * The server adds the binder fd to the looper and, each time it becomes
+ * readable, handles every command the driver has queued.  Transactions
+ * then run on the looper's thread in between its messages and other fd
+ * callbacks, with no handoff to a pool thread on the way in, which suits
+ * services whose handlers are short.
+ *
+ * All incoming calls of the process go to that one thread: start() sets
+ * the thread pool size to zero so the driver never asks for more, and the
+ * process should not start a pool of its own.  A handler that blocks
+ * holds up everything else on the looper.
+ */
+class LooperBinderServer : public LooperCallback
+{
+public:
+    explicit            LooperBinderServer(const sp<Looper>& looper);
+
+    // Both must be called on the looper's thread.
+    status_t            start();
+    void                stop();
+
+    const sp<Looper>&   getLooper() const { return mLooper; }
+
+    virtual int         handleEvent(int fd, int events, void* data);
+
+protected:
+    virtual             ~LooperBinderServer();
+
+private:
+    const sp<Looper>    mLooper;
+    int                 mFd;
+};
+
+// ----------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_LOOPER_BINDER_SERVER_H
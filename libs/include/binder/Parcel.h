@@ -17,6 +17,8 @@
 #ifndef ANDROID_PARCEL_H
 #define ANDROID_PARCEL_H
 
+#include <type_traits>
+
 #include <cutils/native_handle.h>
 #include <utils/Errors.h>
 #include <utils/RefBase.h>
@@ -30,7 +32,9 @@ namespace android {
 
 template <typename T> class Flattenable;
 template <typename T> class LightFlattenable;
+class BlobPool;
 class IBinder;
+class IMemoryHeap;
 class IPCThreadState;
 class ProcessState;
 class String8;
@@ -54,6 +58,9 @@ public:
     status_t            setDataSize(size_t size);
     void                setDataPosition(size_t pos) const;
     status_t            setDataCapacity(size_t size);
+    // Makes room for len more bytes at the current position, so writing
+    // them does not have to grow the parcel again.
+    status_t            reserve(size_t len);
     
     status_t            setData(const uint8_t* buffer, size_t len);
 
@@ -69,6 +76,17 @@ public:
     // Writes the RPC header.
     status_t            writeInterfaceToken(const String16& interface);
 
+    // Same, for a call to target: the header names the interface by a
+    // 64-bit id instead of the full string once target is local or has
+    // replied to an earlier call saying it accepts that, and falls back
+    // to the string otherwise, so older peers keep working.
+    status_t            writeInterfaceToken(const String16& interface,
+                                            const sp<IBinder>& target);
+
+    // Writes the header with the id unconditionally.  Only for a target
+    // known to accept it.
+    status_t            writeCompactInterfaceToken(const String16& interface);
+
     // Parses the RPC header, returning true if the interface name
     // in the header matches the expected interface from the caller.
     //
@@ -107,8 +125,14 @@ public:
     status_t            writeStrongBinder(const sp<IBinder>& val);
     status_t            writeWeakBinder(const wp<IBinder>& val);
     status_t            writeInt32Array(size_t len, const int32_t *val);
+    status_t            writeFloatArray(size_t len, const float *val);
     status_t            writeByteArray(size_t len, const uint8_t *val);
 
+    // Writes an int32 count followed by the elements' bytes, growing the
+    // parcel at most once.  A NULL val is written as a count of -1.
+    template<typename T>
+    status_t            writePodArray(size_t len, const T *val);
+
     template<typename T>
     status_t            write(const Flattenable<T>& val);
 
@@ -139,6 +163,14 @@ public:
     // The caller should call release() on the blob after writing its contents.
     status_t            writeBlob(size_t len, bool mutableCopy, WritableBlob* outBlob);
 
+    // Makes writeBlob() place large blobs in a chunk of pool, which the
+    // reader hands back when it releases its blob or frees the parcel,
+    // instead of in a region of their own.  Such a blob's data is only
+    // valid for as long as the received parcel, like an in-place blob.
+    // Typically the pool is BpBinder::getBlobPool() of the object the
+    // parcel is sent to.  Falls back to a region when the pool is full.
+    void                setBlobPool(const sp<BlobPool>& pool);
+
     // Write an existing immutable blob file descriptor to the parcel.
     // This allows the client to send the same blob to multiple processes
     // as long as it keeps a dup of the blob file descriptor handy for later.
@@ -174,6 +206,24 @@ public:
     String8             readString8() const;
     String16            readString16() const;
     const char16_t*     readString16Inplace(size_t* outLen) const;
+
+    // Read back an array written by the matching write*Array() into val,
+    // which is left empty for a NULL array.
+    status_t            readInt32Array(Vector<int32_t>* val) const;
+    status_t            readFloatArray(Vector<float>* val) const;
+    template<typename T>
+    status_t            readPodArray(Vector<T>* val) const;
+
+    // Like the above, but returns a pointer to the elements inside the
+    // parcel instead of copying them, and the element count in outLen.
+    // The pointer is only valid as long as the parcel's data is, and the
+    // elements are only 4-byte aligned, so readPodArrayInplace() does not
+    // take types that need more.  Returns NULL for a NULL array and on
+    // error.
+    const int32_t*      readInt32ArrayInplace(size_t* outLen) const;
+    const float*        readFloatArrayInplace(size_t* outLen) const;
+    template<typename T>
+    const T*            readPodArrayInplace(size_t* outLen) const;
     sp<IBinder>         readStrongBinder() const;
     wp<IBinder>         readWeakBinder() const;
 
@@ -238,14 +288,24 @@ private:
     status_t            finishWrite(size_t len);
     void                releaseObjects();
     void                acquireObjects();
+    // Hands back the BlobPool chunks of the pool blobs in the parcel, read
+    // or not, whose heap is local or already mapped: on the receiver when
+    // the parcel is freed, and on the sender when the transaction fails.
+    void                releasePoolBlobs() const;
     status_t            growData(size_t len);
     status_t            restartWrite(size_t desired);
     status_t            continueWrite(size_t desired);
+    status_t            writeArray(size_t len, const void* val, size_t elemSize);
+    status_t            readArrayInplace(const void** outData, size_t* outLen,
+                                         size_t elemSize) const;
     status_t            writePointer(uintptr_t val);
     status_t            readPointer(uintptr_t *pArg) const;
     uintptr_t           readPointer() const;
     void                freeDataNoInit();
     void                initState();
+    uint8_t*            allocData(size_t* capacity);
+    void                releaseData(uint8_t* data, size_t capacity);
+    status_t            growObjects(size_t capacity);
     void                scanForFds() const;
                         
     template<class T>
@@ -273,6 +333,12 @@ private:
     release_func        mOwner;
     void*               mOwnerCookie;
 
+    // Small parcels live entirely in these, so they never touch the heap.
+    enum { INLINE_DATA_SIZE = 128, INLINE_OBJECTS = 4 };
+    uint8_t             mInlineData[INLINE_DATA_SIZE]
+                            __attribute__((aligned(sizeof(void*))));
+    binder_size_t       mInlineObjects[INLINE_OBJECTS];
+
     class Blob {
     public:
         Blob();
@@ -291,6 +357,8 @@ private:
         void* mData;
         size_t mSize;
         bool mMutable;
+        sp<IMemoryHeap> mHeap; // keeps a pool blob's heap mapped
+        uint32_t mTicket; // of a pool blob, for BlobPool::release()
     };
 
     class FlattenableHelperInterface {
@@ -342,6 +410,7 @@ public:
 
 private:
     size_t mOpenAshmemSize;
+    sp<BlobPool> mBlobPool;
 
 public:
     // TODO: Remove once ABI can be changed.
@@ -375,6 +444,50 @@ status_t Parcel::write(const LightFlattenable<T>& val) {
     return NO_ERROR;
 }
 
+// libstdc++ only has std::is_trivially_copyable from gcc 5 on, and the
+// Android toolchains still build with gcc 4.9.
+template<typename T>
+struct is_pod_copyable {
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ < 5
+    static const bool value = __has_trivial_copy(T) && __has_trivial_destructor(T);
+#else
+    static const bool value = std::is_trivially_copyable<T>::value;
+#endif
+};
+
+template<typename T>
+status_t Parcel::writePodArray(size_t len, const T *val) {
+    static_assert(is_pod_copyable<T>::value,
+            "writePodArray() needs a trivially copyable type");
+    return writeArray(len, val, sizeof(T));
+}
+
+template<typename T>
+status_t Parcel::readPodArray(Vector<T>* val) const {
+    static_assert(is_pod_copyable<T>::value,
+            "readPodArray() needs a trivially copyable type");
+    const void* data;
+    size_t len;
+    status_t err = readArrayInplace(&data, &len, sizeof(T));
+    val->clear();
+    if (err == NO_ERROR && len > 0
+            && val->appendArray(static_cast<const T*>(data), len) < 0) {
+        err = NO_MEMORY;
+    }
+    return err;
+}
+
+template<typename T>
+const T* Parcel::readPodArrayInplace(size_t* outLen) const {
+    static_assert(is_pod_copyable<T>::value,
+            "readPodArrayInplace() needs a trivially copyable type");
+    static_assert(alignof(T) <= 4,
+            "readPodArrayInplace() only has 4-byte aligned data; use readPodArray()");
+    const void* data;
+    readArrayInplace(&data, outLen, sizeof(T));
+    return static_cast<const T*>(data);
+}
+
 template<typename T>
 status_t Parcel::read(Flattenable<T>& val) const {
     FlattenableHelper<T> helper(val);
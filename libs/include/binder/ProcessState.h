@@ -24,12 +24,14 @@
 
 #include <utils/threads.h>
 
+#include <atomic>
 #include <pthread.h>
 
 // ---------------------------------------------------------------------------
 namespace android {
 
 class IPCThreadState;
+class TransactionExecutor;
 
 class ProcessState : public virtual RefBase
 {
@@ -64,6 +66,19 @@ public:
             status_t            setThreadPoolMaxThreadCount(size_t maxThreads);
             void                giveThreadPoolName();
 
+            // Opt-in: binder threads hand incoming oneway transactions,
+            // including transactAsync() calls, to a work-stealing pool of
+            // workers (0 for one per CPU) and go straight back to the
+            // driver.  Two-way calls still run on the binder thread, since
+            // the driver only takes their BC_REPLY from it; a service whose
+            // replies should come from workers takes transactAsync() calls
+            // (see BBinder::setAsyncCallsEnabled()).  Cannot be turned off
+            // again.
+            // Needs a driver that gives the oneway calls released by a
+            // worker's BC_FREE_BUFFER to the binder threads; an older one
+            // queues them on the worker, which never reads them.
+            status_t            enableTransactionExecutor(size_t workers = 0);
+
 private:
     friend class IPCThreadState;
     
@@ -74,12 +89,27 @@ private:
             ProcessState&       operator=(const ProcessState& o);
             String8             makeBinderThreadName();
 
+            // The handle table is a directory of fixed-size chunks that
+            // are never moved or freed, so existing entries are found
+            // without a lock.  Creating chunks and proxies takes
+            // mHandleLock.  A lock-free reader counts itself in the
+            // entry's readers, and expungeHandle() waits for them before
+            // a dying proxy may go away.
             struct handle_entry {
-                IBinder* binder;
-                RefBase::weakref_type* refs;
+                std::atomic<IBinder*> binder;
+                std::atomic<uint32_t> readers;
+            };
+
+            enum {
+                HANDLE_CHUNK_SHIFT = 8,
+                HANDLE_CHUNK_SIZE = 1 << HANDLE_CHUNK_SHIFT,
+                HANDLE_CHUNKS = 4096,
             };
 
+            handle_entry*       lookupHandle(int32_t handle) const;
             handle_entry*       lookupHandleLocked(int32_t handle);
+            template<typename P>
+            bool                tryGetProxyForHandle(int32_t handle, P* outProxy);
 
             int                 mDriverFD;
             void*               mVMStart;
@@ -92,9 +122,10 @@ private:
             // Maximum number for binder threads allowed for this process.
             size_t              mMaxThreads;
 
-    mutable Mutex               mLock;  // protects everything below.
+            Mutex               mHandleLock;
+            std::atomic<handle_entry*> mHandleChunks[HANDLE_CHUNKS];
 
-            Vector<handle_entry>mHandleToObject;
+    mutable Mutex               mLock;  // protects everything below.
 
             bool                mManagesContexts;
             context_check_func  mBinderContextCheckFunc;
@@ -107,6 +138,8 @@ private:
             String8             mRootDir;
             bool                mThreadPoolStarted;
     volatile int32_t            mThreadPoolSeq;
+
+            std::atomic<TransactionExecutor*> mExecutor;
 };
     
 }; // namespace android
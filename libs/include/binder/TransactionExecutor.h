@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_TRANSACTION_EXECUTOR_H
+#define ANDROID_TRANSACTION_EXECUTOR_H
+
+#include <atomic>
+#include <deque>
+#include <functional>
+
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/RefBase.h>
+#include <utils/Thread.h>
+
+namespace android {
+// ----------------------------------------------------------------------------
+
+/*
+ * A fixed pool of worker threads with one task queue each.
+ *
+ * submit() puts a task on the queue of the CPU it is called from, and
+ * each worker runs its own queue in order, so work handed over on one
+ * core tends to stay there.  A worker whose queue is empty steals the
+ * newest task from another queue before going to sleep.  Tasks on
+ * different queues run in no particular order.
+ */
+class TransactionExecutor
+{
+public:
+    typedef std::function<void()> Task;
+
+    // workers == 0 means one per online CPU.
+    explicit            TransactionExecutor(size_t workers = 0);
+                        ~TransactionExecutor();
+
+    void                submit(const Task& task);
+    size_t              workerCount() const { return mCount; }
+
+private:
+    class Worker;
+    friend class Worker;
+
+    struct queue_t {
+        Mutex           lock;
+        std::deque<Task> tasks;
+    };
+
+    bool                take(size_t self, Task* outTask);
+    bool                runOne(size_t self);
+
+                        TransactionExecutor(const TransactionExecutor&);
+    TransactionExecutor& operator=(const TransactionExecutor&);
+
+    const size_t        mCount;
+    queue_t*            mQueues;
+    std::atomic<size_t> mNextQueue;     // for callers with no known CPU
+
+    // Tasks queued and not yet taken.  Only raised under mIdleLock, so a
+    // worker that finds it zero there can sleep without missing one.
+    std::atomic<size_t> mPending;
+    Mutex               mIdleLock;
+    Condition           mIdle;
+    size_t              mSleepers;
+    bool                mExiting;
+
+    sp<Thread>*         mWorkers;
+};
+
+// ----------------------------------------------------------------------------
+}; // namespace android
+
+#endif // ANDROID_TRANSACTION_EXECUTOR_H
@@ -18,6 +18,11 @@
 
 #include <stddef.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+# define UNICODE_X86_SIMD 1
+# include <immintrin.h>
+#endif
+
 #ifdef HAVE_WINSOCK
 # undef  nhtol
 # undef  htonl
@@ -62,6 +67,207 @@ static const char32_t kFirstByteMark[] = {
     0x00000000, 0x00000000, 0x000000C0, 0x000000E0, 0x000000F0
 };
 
+// --------------------------------------------------------------------------
+// ASCII fast paths
+// --------------------------------------------------------------------------
+
+// Interface tokens, service names and most other strings that cross binder
+// are plain ASCII, so the converters below first hand the longest ASCII
+// run to one of these helpers and only fall back to the per-codepoint
+// loops at the first non-ASCII character.  On x86 the runs are handled 16
+// (SSE2) or 32 (AVX2, picked at run time) units at a time; each helper
+// finishes the remainder with a scalar loop, which is also all there is
+// elsewhere.
+
+#if UNICODE_X86_SIMD
+
+static bool detect_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+static bool cpu_has_avx2()
+{
+    // Initialized once, thread-safely, on first use
+    static const bool avx2 = detect_avx2();
+    return avx2;
+}
+
+__attribute__((target("avx2")))
+static size_t ascii8_len_avx2(const uint8_t* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        if (_mm256_movemask_epi8(v) != 0) break;
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t ascii8_widen_avx2(const uint8_t* src, size_t n, char16_t* dst)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        if (_mm256_movemask_epi8(v) != 0) break;
+        _mm256_storeu_si256((__m256i*)(dst + i),
+                _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+        _mm256_storeu_si256((__m256i*)(dst + i + 16),
+                _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t ascii16_len_avx2(const char16_t* src, size_t n)
+{
+    const __m256i high = _mm256_set1_epi16((short)0xff80);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        if (!_mm256_testz_si256(v, high)) break;
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t utf16_mismatch_avx2(const char16_t* s1, const char16_t* s2, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(s1 + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(s2 + i));
+        unsigned int eq = _mm256_movemask_epi8(_mm256_cmpeq_epi16(a, b));
+        if (eq != 0xffffffffu) return i + __builtin_ctz(~eq) / 2;
+    }
+    return i;
+}
+
+static size_t ascii8_len_sse2(const uint8_t* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        if (_mm_movemask_epi8(v) != 0) break;
+    }
+    return i;
+}
+
+static size_t ascii8_widen_sse2(const uint8_t* src, size_t n, char16_t* dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        if (_mm_movemask_epi8(v) != 0) break;
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128((__m128i*)(dst + i + 8), _mm_unpackhi_epi8(v, zero));
+    }
+    return i;
+}
+
+static size_t ascii16_narrow_sse2(const char16_t* src, size_t n, char* dst)
+{
+    const __m128i high = _mm_set1_epi16((short)0xff80);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 8));
+        __m128i bits = _mm_and_si128(_mm_or_si128(a, b), high);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(bits, zero)) != 0xffff) break;
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(a, b));
+    }
+    return i;
+}
+
+static size_t ascii16_len_sse2(const char16_t* src, size_t n)
+{
+    const __m128i high = _mm_set1_epi16((short)0xff80);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i bits = _mm_and_si128(v, high);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(bits, zero)) != 0xffff) break;
+    }
+    return i;
+}
+
+static size_t utf16_mismatch_sse2(const char16_t* s1, const char16_t* s2, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(s1 + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(s2 + i));
+        unsigned int eq = _mm_movemask_epi8(_mm_cmpeq_epi16(a, b));
+        if (eq != 0xffff) return i + __builtin_ctz(~eq) / 2;
+    }
+    return i;
+}
+
+#endif // UNICODE_X86_SIMD
+
+// Number of leading ASCII bytes in src.
+static inline size_t ascii8_len(const uint8_t* src, size_t n)
+{
+    size_t i = 0;
+#if UNICODE_X86_SIMD
+    i = cpu_has_avx2() ? ascii8_len_avx2(src, n) : ascii8_len_sse2(src, n);
+#endif
+    while (i < n && src[i] < 0x80) i++;
+    return i;
+}
+
+// Copies the leading ASCII bytes of src to dst as UTF-16, returns how many.
+static inline size_t ascii8_widen(const uint8_t* src, size_t n, char16_t* dst)
+{
+    size_t i = 0;
+#if UNICODE_X86_SIMD
+    i = cpu_has_avx2() ? ascii8_widen_avx2(src, n, dst)
+                       : ascii8_widen_sse2(src, n, dst);
+#endif
+    for (; i < n && src[i] < 0x80; i++) dst[i] = src[i];
+    return i;
+}
+
+// Number of leading ASCII units in src.
+static inline size_t ascii16_len(const char16_t* src, size_t n)
+{
+    size_t i = 0;
+#if UNICODE_X86_SIMD
+    i = cpu_has_avx2() ? ascii16_len_avx2(src, n) : ascii16_len_sse2(src, n);
+#endif
+    while (i < n && src[i] < 0x80) i++;
+    return i;
+}
+
+// Copies the leading ASCII units of src to dst as UTF-8, returns how many.
+// Narrowing is store-bound, so SSE2 is as fast as AVX2 here.
+static inline size_t ascii16_narrow(const char16_t* src, size_t n, char* dst)
+{
+    size_t i = 0;
+#if UNICODE_X86_SIMD
+    i = ascii16_narrow_sse2(src, n, dst);
+#endif
+    for (; i < n && src[i] < 0x80; i++) dst[i] = (char)src[i];
+    return i;
+}
+
+// Index of the first unit where s1 and s2 differ, or n.
+static inline size_t utf16_mismatch(const char16_t* s1, const char16_t* s2, size_t n)
+{
+    size_t i = 0;
+#if UNICODE_X86_SIMD
+    i = cpu_has_avx2() ? utf16_mismatch_avx2(s1, s2, n)
+                       : utf16_mismatch_sse2(s1, s2, n);
+#endif
+    while (i < n && s1[i] == s2[i]) i++;
+    return i;
+}
+
 // --------------------------------------------------------------------------
 // UTF-32
 // --------------------------------------------------------------------------
@@ -286,15 +492,13 @@ size_t strnlen16(const char16_t *s, size_t maxlen)
 
 int strzcmp16(const char16_t *s1, size_t n1, const char16_t *s2, size_t n2)
 {
-    const char16_t* e1 = s1+n1;
-    const char16_t* e2 = s2+n2;
-
-    while (s1 < e1 && s2 < e2) {
-        const int d = (int)*s1++ - (int)*s2++;
-        if (d) {
-            return d;
-        }
+    const size_t n = n1 < n2 ? n1 : n2;
+    const size_t i = utf16_mismatch(s1, s2, n);
+    if (i < n) {
+        return (int)s1[i] - (int)s2[i];
     }
+    s1 += n;
+    s2 += n;
 
     return n1 < n2
         ? (0 - (int)*s2)
@@ -334,6 +538,13 @@ void utf16_to_utf8(const char16_t* src, size_t src_len, char* dst)
     const char16_t* const end_utf16 = src + src_len;
     char *cur = dst;
     while (cur_utf16 < end_utf16) {
+        const size_t ascii = ascii16_narrow(cur_utf16, end_utf16 - cur_utf16, cur);
+        cur_utf16 += ascii;
+        cur += ascii;
+        if (cur_utf16 == end_utf16) {
+            break;
+        }
+
         char32_t utf32;
         // surrogate pairs
         if((*cur_utf16 & 0xFC00) == 0xD800 && (cur_utf16 + 1) < end_utf16
@@ -407,6 +618,13 @@ ssize_t utf16_to_utf8_length(const char16_t *src, size_t src_len)
     size_t ret = 0;
     const char16_t* const end = src + src_len;
     while (src < end) {
+        const size_t ascii = ascii16_len(src, end - src);
+        ret += ascii;
+        src += ascii;
+        if (src == end) {
+            break;
+        }
+
         if ((*src & 0xFC00) == 0xD800 && (src + 1) < end
                 && (*++src & 0xFC00) == 0xDC00) {
             // surrogate pairs are always 4 bytes.
@@ -519,6 +737,13 @@ ssize_t utf8_to_utf16_length(const uint8_t* u8str, size_t u8len)
     /* Validate that the UTF-8 is the correct len */
     size_t u16measuredLen = 0;
     while (u8cur < u8end) {
+        const size_t ascii = ascii8_len(u8cur, u8end - u8cur);
+        u16measuredLen += ascii;
+        u8cur += ascii;
+        if (u8cur == u8end) {
+            break;
+        }
+
         u16measuredLen++;
         int u8charLen = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8charLen);
@@ -544,6 +769,13 @@ char16_t* utf8_to_utf16_no_null_terminator(const uint8_t* u8str, size_t u8len, c
     char16_t* u16cur = u16str;
 
     while (u8cur < u8end) {
+        const size_t ascii = ascii8_widen(u8cur, u8end - u8cur, u16cur);
+        u8cur += ascii;
+        u16cur += ascii;
+        if (u8cur == u8end) {
+            break;
+        }
+
         size_t u8len = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8len);
 
@@ -575,6 +807,15 @@ char16_t* utf8_to_utf16_n(const uint8_t* src, size_t srcLen, char16_t* dst, size
     char16_t* u16cur = dst;
 
     while (u8cur < u8end && u16cur < u16end) {
+        const size_t room = u16end - u16cur;
+        const size_t ascii = ascii8_widen(u8cur,
+                (size_t)(u8end - u8cur) < room ? u8end - u8cur : room, u16cur);
+        u8cur += ascii;
+        u16cur += ascii;
+        if (u8cur == u8end || u16cur == u16end) {
+            break;
+        }
+
         size_t u8len = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8len);
 
@@ -71,6 +71,7 @@ const char *cmd_name(uint32_t cmd)
         NAME(BR_TRANSACTION);
         NAME(BR_REPLY);
         NAME(BR_FAILED_REPLY);
+        NAME(BR_BUFFER_LIMIT_REPLY);
         NAME(BR_DEAD_REPLY);
         NAME(BR_DEAD_BINDER);
     default: return "???";
@@ -91,6 +92,7 @@ struct binder_state
     int fd;
     void *mapped;
     size_t mapsize;
+    uint32_t reply_flags;
 };
 
 struct binder_state *binder_open(size_t mapsize)
@@ -119,6 +121,7 @@ struct binder_state *binder_open(size_t mapsize)
         goto fail_open;
     }
 
+    bs->reply_flags = 0;
     bs->mapsize = mapsize;
     bs->mapped = mmap(NULL, mapsize, PROT_READ, MAP_PRIVATE, bs->fd, 0);
     if (bs->mapped == MAP_FAILED) {
@@ -143,6 +146,11 @@ void binder_close(struct binder_state *bs)
     free(bs);
 }
 
+void binder_set_reply_flags(struct binder_state *bs, uint32_t flags)
+{
+    bs->reply_flags = flags;
+}
+
 int binder_become_context_manager(struct binder_state *bs)
 {
     return ioctl(bs->fd, BINDER_SET_CONTEXT_MGR, 0);
@@ -192,7 +200,7 @@ void binder_send_reply(struct binder_state *bs,
         data.txn.data.ptr.buffer = (uintptr_t)&status;
         data.txn.data.ptr.offsets = 0;
     } else {
-        data.txn.flags = 0;
+        data.txn.flags = bs->reply_flags;
         data.txn.data_size = reply->data - reply->data0;
         data.txn.offsets_size = ((char*) reply->offs) - ((char*) reply->offs0);
         data.txn.data.ptr.buffer = (uintptr_t)reply->data0;
@@ -201,6 +209,29 @@ void binder_send_reply(struct binder_state *bs,
     binder_write(bs, &data, sizeof(data));
 }
 
+/* A death is acknowledged once handled, so that the driver can finish
+ * a binder_clear_death() that raced with it. */
+static void binder_death_event(struct binder_state *bs, uint32_t cmd,
+                               binder_uintptr_t cookie)
+{
+    struct binder_death *death = (struct binder_death *)(uintptr_t) cookie;
+    struct {
+        uint32_t cmd;
+        binder_uintptr_t cookie;
+    } __attribute__((packed)) data;
+
+    if (cmd == BR_CLEAR_DEATH_NOTIFICATION_DONE) {
+        if (death->cleared)
+            death->cleared(bs, death->ptr);
+        return;
+    }
+
+    death->func(bs, death->ptr);
+    data.cmd = BC_DEAD_BINDER_DONE;
+    data.cookie = cookie;
+    binder_write(bs, &data, sizeof(data));
+}
+
 int binder_parse(struct binder_state *bs, struct binder_io *bio,
                  uintptr_t ptr, size_t size, binder_handler func)
 {
@@ -265,15 +296,17 @@ int binder_parse(struct binder_state *bs, struct binder_io *bio,
             r = 0;
             break;
         }
-        case BR_DEAD_BINDER: {
-            struct binder_death *death = (struct binder_death *)(uintptr_t) *(binder_uintptr_t *)ptr;
+        case BR_DEAD_BINDER:
+        case BR_CLEAR_DEATH_NOTIFICATION_DONE:
+            binder_death_event(bs, cmd, *(binder_uintptr_t *)ptr);
             ptr += sizeof(binder_uintptr_t);
-            death->func(bs, death->ptr);
             break;
-        }
         case BR_FAILED_REPLY:
             r = -1;
             break;
+        case BR_BUFFER_LIMIT_REPLY:
+            r = -1;
+            break;
         case BR_DEAD_REPLY:
             r = -1;
             break;
@@ -315,6 +348,19 @@ void binder_link_to_death(struct binder_state *bs, uint32_t target, struct binde
     binder_write(bs, &data, sizeof(data));
 }
 
+void binder_clear_death(struct binder_state *bs, uint32_t target, struct binder_death *death)
+{
+    struct {
+        uint32_t cmd;
+        struct binder_handle_cookie payload;
+    } __attribute__((packed)) data;
+
+    data.cmd = BC_CLEAR_DEATH_NOTIFICATION;
+    data.payload.handle = target;
+    data.payload.cookie = (uintptr_t) death;
+    binder_write(bs, &data, sizeof(data));
+}
+
 int binder_call(struct binder_state *bs,
                 struct binder_io *msg, struct binder_io *reply,
                 uint32_t target, uint32_t code)
@@ -369,6 +415,84 @@ fail:
     return -1;
 }
 
+int binder_call_oneway(struct binder_state *bs,
+                       struct binder_io *msg,
+                       uint32_t target, uint32_t code)
+{
+    int res;
+    int done = 0;
+    struct binder_write_read bwr;
+    struct {
+        uint32_t cmd;
+        struct binder_transaction_data txn;
+    } __attribute__((packed)) writebuf;
+    uint32_t readbuf[32];
+
+    if (msg->flags & BIO_F_OVERFLOW) {
+        fprintf(stderr,"binder: txn buffer overflow\n");
+        return -1;
+    }
+
+    writebuf.cmd = BC_TRANSACTION;
+    writebuf.txn.target.handle = target;
+    writebuf.txn.code = code;
+    writebuf.txn.flags = TF_ONE_WAY;
+    writebuf.txn.data_size = msg->data - msg->data0;
+    writebuf.txn.offsets_size = ((char*) msg->offs) - ((char*) msg->offs0);
+    writebuf.txn.data.ptr.buffer = (uintptr_t)msg->data0;
+    writebuf.txn.data.ptr.offsets = (uintptr_t)msg->offs0;
+
+    bwr.write_size = sizeof(writebuf);
+    bwr.write_consumed = 0;
+    bwr.write_buffer = (uintptr_t) &writebuf;
+
+    /* The outcome comes back on this thread's own queue: a transaction
+     * complete, or a dead/failed reply that would otherwise turn up
+     * later in binder_loop() and stop it. */
+    while (!done) {
+        uintptr_t ptr, end;
+
+        bwr.read_size = sizeof(readbuf);
+        bwr.read_consumed = 0;
+        bwr.read_buffer = (uintptr_t) readbuf;
+
+        res = ioctl(bs->fd, BINDER_WRITE_READ, &bwr);
+        if (res < 0) {
+            fprintf(stderr,"binder: ioctl failed (%s)\n", strerror(errno));
+            return -1;
+        }
+
+        ptr = (uintptr_t) readbuf;
+        end = ptr + bwr.read_consumed;
+        while (ptr < end) {
+            uint32_t cmd = *(uint32_t *) ptr;
+            ptr += sizeof(uint32_t);
+            switch(cmd) {
+            case BR_NOOP:
+                break;
+            case BR_TRANSACTION_COMPLETE:
+                done = 1;
+                break;
+            case BR_DEAD_REPLY:
+            case BR_FAILED_REPLY:
+                done = -1;
+                break;
+            case BR_DEAD_BINDER:
+            case BR_CLEAR_DEATH_NOTIFICATION_DONE:
+                binder_death_event(bs, cmd, *(binder_uintptr_t *)ptr);
+                ptr += sizeof(binder_uintptr_t);
+                break;
+            default:
+                ALOGE("call_oneway: OOPS %d\n", cmd);
+                return -1;
+            }
+        }
+        bwr.write_size = 0;
+    }
+
+    return done > 0 ? 0 : -1;
+}
+
 void binder_loop(struct binder_state *bs, binder_handler func)
 {
     int res;
@@ -597,6 +721,19 @@ uint32_t bio_get_uint32(struct binder_io *bio)
     return ptr ? *ptr : 0;
 }
 
+uint64_t bio_get_uint64(struct binder_io *bio)
+{
+    uint64_t *ptr = bio_get(bio, sizeof(*ptr));
+    return ptr ? *ptr : 0;
+}
+
+uint32_t bio_peek_uint32(struct binder_io *bio)
+{
+    if (bio->data_avail < sizeof(uint32_t))
+        return 0;
+    return *(uint32_t *) bio->data;
+}
+
 uint16_t *bio_get_string16(struct binder_io *bio, size_t *sz)
 {
     size_t len;
@@ -25,6 +25,8 @@ struct binder_io
 struct binder_death {
     void (*func)(struct binder_state *bs, void *ptr);
     void *ptr;
+    /* optional, called once a binder_clear_death() is done with it */
+    void (*cleared)(struct binder_state *bs, void *ptr);
 };
 
 /* the one magic handle */
@@ -39,6 +41,13 @@ enum {
     SVC_MGR_CHECK_SERVICE,
     SVC_MGR_ADD_SERVICE,
     SVC_MGR_LIST_SERVICES,
+    SVC_MGR_NOTIFY_SERVICE,
+    SVC_MGR_CANCEL_NOTIFY,
+};
+
+enum {
+    /* sent to the callback of SVC_MGR_NOTIFY_SERVICE */
+    SVC_MGR_SERVICE_REGISTERED = 1,
 };
 
 typedef int (*binder_handler)(struct binder_state *bs,
@@ -56,6 +65,14 @@ int binder_call(struct binder_state *bs,
                 struct binder_io *msg, struct binder_io *reply,
                 uint32_t target, uint32_t code);
 
+/* send a oneway binder call
+ * - returns zero once the driver has taken it, nonzero if the
+ *   target is dead or the call failed
+ */
+int binder_call_oneway(struct binder_state *bs,
+                       struct binder_io *msg,
+                       uint32_t target, uint32_t code);
+
 /* release any state associate with the binder_io
  * - call once any necessary data has been extracted from the
  *   binder_io after binder_call() returns
@@ -70,10 +87,19 @@ void binder_release(struct binder_state *bs, uint32_t target);
 
 void binder_link_to_death(struct binder_state *bs, uint32_t target, struct binder_death *death);
 
+/* undo binder_link_to_death()
+ * - death must stay valid until its cleared callback runs, which
+ *   may come after func if the target died meanwhile
+ */
+void binder_clear_death(struct binder_state *bs, uint32_t target, struct binder_death *death);
+
 void binder_loop(struct binder_state *bs, binder_handler func);
 
 int binder_become_context_manager(struct binder_state *bs);
 
+/* extra transaction flags for every reply sent by binder_loop() */
+void binder_set_reply_flags(struct binder_state *bs, uint32_t flags);
+
 /* allocate a binder_io, providing a stack-allocated working
  * buffer, size of the working buffer, and how many object
  * offset entries to reserve from the buffer
@@ -88,6 +114,8 @@ void bio_put_string16(struct binder_io *bio, const uint16_t *str);
 void bio_put_string16_x(struct binder_io *bio, const char *_str);
 
 uint32_t bio_get_uint32(struct binder_io *bio);
+uint64_t bio_get_uint64(struct binder_io *bio);
+uint32_t bio_peek_uint32(struct binder_io *bio);
 uint16_t *bio_get_string16(struct binder_io *bio, size_t *sz);
 uint32_t bio_get_ref(struct binder_io *bio);
 
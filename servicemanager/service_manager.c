@@ -127,7 +127,8 @@ static int svc_can_find(const uint16_t *name, size_t name_len, pid_t spid)
 
 struct svcinfo
 {
-    struct svcinfo *next;
+    struct svcinfo *hnext;  /* next in the same hash bucket */
+    uint32_t hash;
     uint32_t handle;
     struct binder_death death;
     int allow_isolated;
@@ -135,14 +136,39 @@ struct svcinfo
     uint16_t name[0];
 };
 
-struct svcinfo *svclist = NULL;
+/* Services are found by name through a hash table with a power of two
+ * buckets, grown to keep at most one service per bucket on average, and
+ * listed by index from an array in order of registration.  Entries are
+ * never removed; a dead service just loses its handle. */
+struct svcinfo **svchash = NULL;
+size_t svchash_size = 0;
+struct svcinfo **svcvec = NULL;
+size_t svccount = 0;
+size_t svcvec_size = 0;
+
+uint32_t svc_hash(const uint16_t *s16, size_t len)
+{
+    /* FNV-1a over the UTF-16 code units */
+    uint32_t hash = 2166136261u;
+
+    while (len--) {
+        hash ^= *s16++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
 struct svcinfo *find_svc(const uint16_t *s16, size_t len)
 {
     struct svcinfo *si;
+    uint32_t hash;
 
-    for (si = svclist; si; si = si->next) {
-        if ((len == si->len) &&
+    if (!svchash_size)
+        return NULL;
+
+    hash = svc_hash(s16, len);
+    for (si = svchash[hash & (svchash_size - 1)]; si; si = si->hnext) {
+        if ((hash == si->hash) && (len == si->len) &&
             !memcmp(s16, si->name, len * sizeof(uint16_t))) {
             return si;
         }
@@ -150,6 +176,41 @@ struct svcinfo *find_svc(const uint16_t *s16, size_t len)
     return NULL;
 }
 
+int add_svc(struct svcinfo *si)
+{
+    size_t n;
+
+    if (svccount == svcvec_size) {
+        size_t size = svcvec_size ? svcvec_size * 2 : 64;
+        struct svcinfo **vec = realloc(svcvec, size * sizeof(*vec));
+        if (!vec)
+            return -1;
+        svcvec = vec;
+        svcvec_size = size;
+    }
+
+    if (svccount == svchash_size) {
+        size_t size = svchash_size ? svchash_size * 2 : 64;
+        struct svcinfo **hash = calloc(size, sizeof(*hash));
+        if (!hash)
+            return -1;
+        for (n = 0; n < svccount; n++) {
+            struct svcinfo *old = svcvec[n];
+            old->hnext = hash[old->hash & (size - 1)];
+            hash[old->hash & (size - 1)] = old;
+        }
+        free(svchash);
+        svchash = hash;
+        svchash_size = size;
+    }
+
+    si->hash = svc_hash(si->name, si->len);
+    si->hnext = svchash[si->hash & (svchash_size - 1)];
+    svchash[si->hash & (svchash_size - 1)] = si;
+    svcvec[svccount++] = si;
+    return 0;
+}
+
 void svcinfo_death(struct binder_state *bs, void *ptr)
 {
     struct svcinfo *si = (struct svcinfo* ) ptr;
@@ -161,11 +222,179 @@ void svcinfo_death(struct binder_state *bs, void *ptr)
     }
 }
 
+/* A client waiting for a service to be registered, through a callback
+ * binder we hold a reference on until it has been told, has cancelled
+ * or has died.  A callback waits for one name at a time.  One that is
+ * done with while still alive keeps its entry, with no handle, until
+ * the driver has cleared its death notification. */
+struct svcwaiter
+{
+    struct svcwaiter *next;
+    uint32_t handle;
+    struct binder_death death;
+    size_t len;
+    uint16_t name[0];
+};
+
+struct svcwaiter *waiterlist = NULL;
+
+struct svcwaiter *find_waiter(uint32_t handle)
+{
+    struct svcwaiter *sw;
+
+    for (sw = waiterlist; sw; sw = sw->next) {
+        if (sw->handle == handle)
+            return sw;
+    }
+    return NULL;
+}
+
+void free_waiter(struct svcwaiter *sw)
+{
+    struct svcwaiter **link;
+
+    for (link = &waiterlist; *link; link = &(*link)->next) {
+        if (*link == sw) {
+            *link = sw->next;
+            break;
+        }
+    }
+    free(sw);
+}
+
+void svcwaiter_death(struct binder_state *bs, void *ptr)
+{
+    struct svcwaiter *sw = (struct svcwaiter *) ptr;
+
+    /* Otherwise already let go, and freed once cleared */
+    if (sw->handle) {
+        binder_release(bs, sw->handle);
+        free_waiter(sw);
+    }
+}
+
+void svcwaiter_cleared(struct binder_state *bs, void *ptr)
+{
+    free_waiter((struct svcwaiter *) ptr);
+}
+
+void drop_waiter(struct binder_state *bs, struct svcwaiter *sw)
+{
+    binder_clear_death(bs, sw->handle, &sw->death);
+    binder_release(bs, sw->handle);
+    sw->handle = 0;
+}
+
+int do_add_waiter(struct binder_state *bs,
+                  const uint16_t *s, size_t len,
+                  uint32_t handle, pid_t spid)
+{
+    struct svcwaiter *sw;
+
+    if (!handle || (len == 0) || (len > 127))
+        return -1;
+
+    if (!svc_can_find(s, len, spid))
+        return -1;
+
+    /* The driver gives a node the same handle every time */
+    sw = find_waiter(handle);
+    if (sw) {
+        if ((sw->len == len) && !memcmp(sw->name, s, len * sizeof(uint16_t)))
+            return 0;
+        ALOGE("notify_service('%s',%x) - ALREADY WAITING\n",
+             str8(s, len), handle);
+        return -1;
+    }
+
+    sw = malloc(sizeof(*sw) + (len + 1) * sizeof(uint16_t));
+    if (!sw) {
+        ALOGE("notify_service('%s',%x) - OUT OF MEMORY\n",
+             str8(s, len), handle);
+        return -1;
+    }
+    sw->handle = handle;
+    sw->len = len;
+    memcpy(sw->name, s, len * sizeof(uint16_t));
+    sw->name[len] = '\0';
+    sw->next = waiterlist;
+    waiterlist = sw;
+
+    binder_acquire(bs, handle);
+    sw->death.func = svcwaiter_death;
+    sw->death.ptr = sw;
+    sw->death.cleared = svcwaiter_cleared;
+    binder_link_to_death(bs, handle, &sw->death);
+    return 0;
+}
+
+int do_cancel_waiter(struct binder_state *bs,
+                     const uint16_t *s, size_t len, uint32_t handle)
+{
+    struct svcwaiter *sw = handle ? find_waiter(handle) : NULL;
+
+    if (!sw || (sw->len != len) ||
+        memcmp(sw->name, s, len * sizeof(uint16_t)))
+        return -1;
+
+    drop_waiter(bs, sw);
+    return 0;
+}
+
+void notify_waiters(struct binder_state *bs, struct svcinfo *si)
+{
+    struct svcwaiter *sw;
+    unsigned iodata[512/4];
+    struct binder_io msg;
+
+    /* Deaths read during a call can free any waiter, so the scan starts
+     * over after each one; those already told have no handle. */
+    sw = waiterlist;
+    while (sw) {
+        uint32_t handle = sw->handle;
+
+        if (!handle || (sw->len != si->len) ||
+            memcmp(sw->name, si->name, si->len * sizeof(uint16_t))) {
+            sw = sw->next;
+            continue;
+        }
+
+        binder_clear_death(bs, handle, &sw->death);
+        sw->handle = 0;
+
+        /* A waiter that died or gave up just misses the call */
+        bio_init(&msg, iodata, sizeof(iodata), 4);
+        bio_put_ref(&msg, si->handle);
+        binder_call_oneway(bs, &msg, handle, SVC_MGR_SERVICE_REGISTERED);
+        binder_release(bs, handle);
+        sw = waiterlist;
+    }
+}
+
 uint16_t svcmgr_id[] = {
     'a','n','d','r','o','i','d','.','o','s','.',
     'I','S','e','r','v','i','c','e','M','a','n','a','g','e','r'
 };
 
+/* Parcel's compact interface token: this marker in place of the name's
+ * length, then the FNV-1a hash of the name's UTF-16 units.  Callers only
+ * send it once a reply of ours has carried TF_COMPACT_TOKENS. */
+#define COMPACT_INTERFACE_TOKEN 0xfffffffeU
+
+uint64_t svcmgr_token(void)
+{
+    static uint64_t token;
+    size_t i;
+
+    if (!token) {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (i = 0; i < sizeof(svcmgr_id) / 2; i++)
+            hash = (hash ^ svcmgr_id[i]) * 0x100000001b3ULL;
+        token = hash;
+    }
+    return token;
+}
+
 
 uint32_t do_find_service(struct binder_state *bs, const uint16_t *s, size_t len, uid_t uid, pid_t spid)
 {
@@ -231,13 +460,19 @@ int do_add_service(struct binder_state *bs,
         si->name[len] = '\0';
         si->death.func = (void*) svcinfo_death;
         si->death.ptr = si;
+        si->death.cleared = NULL;
         si->allow_isolated = allow_isolated;
-        si->next = svclist;
-        svclist = si;
+        if (add_svc(si)) {
+            ALOGE("add_service('%s',%x) uid=%d - OUT OF MEMORY\n",
+                 str8(s, len), handle, uid);
+            free(si);
+            return -1;
+        }
     }
 
     binder_acquire(bs, handle);
     binder_link_to_death(bs, handle, &si->death);
+    notify_waiters(bs, si);
     return 0;
 }
 
@@ -246,7 +481,6 @@ int svcmgr_handler(struct binder_state *bs,
                    struct binder_io *msg,
                    struct binder_io *reply)
 {
-    struct svcinfo *si;
     uint16_t *s;
     size_t len;
     uint32_t handle;
@@ -267,15 +501,26 @@ int svcmgr_handler(struct binder_state *bs,
     // Note that we ignore the strict_policy and don't propagate it
     // further (since we do no outbound RPCs anyway).
     strict_policy = bio_get_uint32(msg);
-    s = bio_get_string16(msg, &len);
-    if (s == NULL) {
-        return -1;
-    }
+    if (bio_peek_uint32(msg) == COMPACT_INTERFACE_TOKEN) {
+        uint64_t id;
 
-    if ((len != (sizeof(svcmgr_id) / 2)) ||
-        memcmp(svcmgr_id, s, sizeof(svcmgr_id))) {
-        fprintf(stderr,"invalid id %s\n", str8(s, len));
-        return -1;
+        bio_get_uint32(msg);
+        id = bio_get_uint64(msg);
+        if (id != svcmgr_token()) {
+            fprintf(stderr,"invalid id %016" PRIx64 "\n", id);
+            return -1;
+        }
+    } else {
+        s = bio_get_string16(msg, &len);
+        if (s == NULL) {
+            return -1;
+        }
+
+        if ((len != (sizeof(svcmgr_id) / 2)) ||
+            memcmp(svcmgr_id, s, sizeof(svcmgr_id))) {
+            fprintf(stderr,"invalid id %s\n", str8(s, len));
+            return -1;
+        }
     }
 
     // if (sehandle && selinux_status_updated() > 0) {
@@ -311,6 +556,29 @@ int svcmgr_handler(struct binder_state *bs,
             return -1;
         break;
 
+    case SVC_MGR_NOTIFY_SERVICE:
+        s = bio_get_string16(msg, &len);
+        if (s == NULL) {
+            return -1;
+        }
+        handle = do_find_service(bs, s, len, txn->sender_euid, txn->sender_pid);
+        if (handle) {
+            bio_put_ref(reply, handle);
+            return 0;
+        }
+        if (do_add_waiter(bs, s, len, bio_get_ref(msg), txn->sender_pid))
+            return -1;
+        break;
+
+    case SVC_MGR_CANCEL_NOTIFY:
+        s = bio_get_string16(msg, &len);
+        if (s == NULL) {
+            return -1;
+        }
+        if (do_cancel_waiter(bs, s, len, bio_get_ref(msg)))
+            return -1;
+        break;
+
     case SVC_MGR_LIST_SERVICES: {
         uint32_t n = bio_get_uint32(msg);
 
@@ -319,11 +587,9 @@ int svcmgr_handler(struct binder_state *bs,
                     txn->sender_euid);
             return -1;
         }
-        si = svclist;
-        while ((n-- > 0) && si)
-            si = si->next;
-        if (si) {
-            bio_put_string16(reply, si->name);
+        /* Newest first, as the list used to be kept */
+        if (n < svccount) {
+            bio_put_string16(reply, svcvec[svccount - 1 - n]->name);
             return 0;
         }
         return -1;
@@ -358,6 +624,7 @@ int main(int argc, char **argv)
         ALOGE("cannot become context manager (%s)\n", strerror(errno));
         return -1;
     }
+    binder_set_reply_flags(bs, TF_COMPACT_TOKENS);
 
     selinux_enabled = 0;
     // selinux_enabled = is_selinux_enabled();
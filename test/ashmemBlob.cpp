@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Blob create/map/destroy benchmark
+ *
+ * Measures what a Parcel blob too large to be written in place costs:
+ * creating the ashmem region, mapping it, filling it, reading it back
+ * through a second mapping and tearing everything down.  The same loop
+ * is also timed with the bare ashmem calls, and with the parcel writing
+ * into a persistent BlobPool, where the chunk is recycled as soon as the
+ * reader releases its blob.  Uses /dev/ashmem when it exists and the
+ * memfd fallback in libcutils otherwise; no binder driver is needed.
+ *
+ * This benchmark supports the following command-line options:
+ *
+ *   -n num - blobs per size (default: 10000)
+ *   -p size - only test this blob size in bytes
+ *             (default: 32K, 256K, 1M and 4M)
+ */
+
+#include <cerrno>
+#include <iostream>
+#include <libgen.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include <binder/BlobPool.h>
+#include <binder/Parcel.h>
+#include <cutils/ashmem.h>
+#include "testUtil.h"
+
+using namespace android;
+using namespace std;
+
+struct options {
+    unsigned int iterations;
+    size_t       blobSize;  // 0 for the default set of sizes
+} options = { // Set defaults
+    10000,  // Iterations
+    0,      // Blob size
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts2double(&ts);
+}
+
+// One blob through a Parcel: writeBlob, fill, readBlob, release both
+static double parcelBlob(size_t size, const sp<BlobPool>& pool)
+{
+    double start = now();
+
+    for (unsigned int i = 0; i < options.iterations; i++) {
+        Parcel parcel;
+        if (pool != NULL) parcel.setBlobPool(pool);
+        Parcel::WritableBlob out;
+        if (parcel.writeBlob(size, false, &out) != NO_ERROR) {
+            cerr << "writeBlob failed, size: " << size << endl;
+            exit(10);
+        }
+        memset(out.data(), i, size);
+        out.release();
+
+        parcel.setDataPosition(0);
+        Parcel::ReadableBlob in;
+        if (parcel.readBlob(size, &in) != NO_ERROR) {
+            cerr << "readBlob failed, size: " << size << endl;
+            exit(11);
+        }
+        if (((const unsigned char *) in.data())[size - 1] != (unsigned char) i) {
+            cerr << "blob contents lost, size: " << size << endl;
+            exit(12);
+        }
+        in.release();
+    }
+
+    return (now() - start) / options.iterations;
+}
+
+// The same steps with the bare ashmem calls
+static double rawRegion(size_t size)
+{
+    double start = now();
+
+    for (unsigned int i = 0; i < options.iterations; i++) {
+        int fd = ashmem_create_region("ashmemBlob", size);
+        if (fd < 0) {
+            cerr << "ashmem_create_region failed, errno: " << errno << endl;
+            exit(13);
+        }
+        void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) {
+            cerr << "mmap failed, errno: " << errno << endl;
+            exit(14);
+        }
+        memset(ptr, i, size);
+        ashmem_set_prot_region(fd, PROT_READ);
+        munmap(ptr, size);
+        close(fd);
+    }
+
+    return (now() - start) / options.iterations;
+}
+
+int main(int argc, char *argv[])
+{
+    // Parse command line arguments
+    int opt;
+    while ((opt = getopt(argc, argv, "n:p:?")) != -1) {
+        char *chptr; // character pointer for command-line parsing
+
+        switch (opt) {
+        case 'n': // iterations
+            options.iterations = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (options.iterations < 1)) {
+                cerr << "Invalid iterations specified of: " << optarg << endl;
+                exit(2);
+            }
+            break;
+
+        case 'p': // blob size
+            options.blobSize = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (options.blobSize < 1)) {
+                cerr << "Invalid blob size specified of: " << optarg << endl;
+                exit(3);
+            }
+            break;
+
+        case '?':
+        default:
+            cerr << basename(argv[0]) << " [options]" << endl;
+            cerr << "  options:" << endl;
+            cerr << "    -n num - blobs per size" << endl;
+            cerr << "    -p size - blob size in bytes" << endl;
+            exit(((optopt == 0) || (optopt == '?')) ? 0 : 4);
+        }
+    }
+
+    // Display selected options
+    cout << "iterations: " << options.iterations << endl;
+    cout << "backend: "
+        << (access("/dev/ashmem", F_OK) == 0 ? "/dev/ashmem" : "memfd") << endl;
+
+    static const size_t defaultSizes[] = {
+        32 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024,
+    };
+    const size_t *sizes = options.blobSize ? &options.blobSize : defaultSizes;
+    size_t count = options.blobSize ? 1
+        : sizeof(defaultSizes) / sizeof(defaultSizes[0]);
+
+    for (size_t i = 0; i < count; i++) {
+        // Room for a few blobs, so the pool never falls back
+        sp<BlobPool> pool = new BlobPool(4 * sizes[i] + 65536, "ashmemBlob");
+
+        cout << "size " << sizes[i] << ":" << endl;
+        cout << "  parcel blob: " << parcelBlob(sizes[i], NULL) * 1e6 << " usec" << endl;
+        cout << "  pool blob: " << parcelBlob(sizes[i], pool) * 1e6 << " usec" << endl;
+        cout << "  raw region: " << rawRegion(sizes[i]) * 1e6 << " usec" << endl;
+        if (pool->busyCount() != 0) {
+            cerr << "pool chunks not recycled: " << pool->busyCount() << endl;
+            exit(15);
+        }
+    }
+
+    return 0;
+}
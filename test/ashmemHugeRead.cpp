@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Ashmem huge page random read benchmark
+ *
+ * Measures random read latency over a large ashmem region, once backed
+ * by regular pages and once with huge pages requested through
+ * ASHMEM_SET_HUGE.  The reads are dependent loads at random offsets, so
+ * the result is dominated by TLB and cache misses.  ASHMEM_SET_HUGE
+ * fails on kernels whose shmem cannot use huge pages (before 4.8), and
+ * whether shmem really used them depends on
+ * /sys/kernel/mm/transparent_hugepage/shmem_enabled; the amount mapped
+ * with huge pages is reported from /proc/self/smaps when available.
+ *
+ * This benchmark supports the following command-line options:
+ *
+ *   -m size - region size in MB (default: 512)
+ *   -n num - number of random reads (default: 10000000)
+ *   -H - only run with huge pages (default: both modes)
+ *   -S - only run with regular pages (default: both modes)
+ */
+
+#include <cerrno>
+#include <fstream>
+#include <iostream>
+#include <libgen.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <cutils/ashmem.h>
+#include "testUtil.h"
+
+typedef unsigned int __u32;
+#include <driver/ashmem/uapi_ashmem.h>
+
+using namespace std;
+
+struct options {
+    size_t       regionMB;
+    unsigned int reads;
+    bool         huge;      // Run with huge pages
+    bool         small;     // Run with regular pages
+} options = { // Set defaults
+    512,       // Region size
+    10000000,  // Reads
+    true,      // Huge pages
+    true,      // Regular pages
+};
+
+// Size mapped with huge pages at addr, in kB, or -1 if not reported
+static long hugeMappedKB(void *addr)
+{
+    ifstream smaps("/proc/self/smaps");
+    string line;
+    bool inMapping = false;
+
+    while (getline(smaps, line)) {
+        unsigned long start, end;
+        if (sscanf(line.c_str(), "%lx-%lx ", &start, &end) == 2) {
+            inMapping = (uintptr_t) addr >= start && (uintptr_t) addr < end;
+        } else if (inMapping && line.compare(0, 15, "ShmemPmdMapped:") == 0) {
+            return strtol(line.c_str() + 15, NULL, 10);
+        }
+    }
+    return -1;
+}
+
+static void run(bool huge)
+{
+    size_t size = options.regionMB * 1024 * 1024;
+    int fd = ashmem_create_region("ashmemHugeRead", size);
+    if (fd < 0) {
+        cerr << "ashmem_create_region failed, errno: " << errno << endl;
+        exit(10);
+    }
+    if (huge && ioctl(fd, ASHMEM_SET_HUGE, 1) < 0) {
+        cerr << "ASHMEM_SET_HUGE failed, errno: " << errno << endl;
+        exit(11);
+    }
+
+    uint64_t *words = (uint64_t *) mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED, fd, 0);
+    if (words == MAP_FAILED) {
+        cerr << "mmap failed, errno: " << errno << endl;
+        exit(12);
+    }
+
+    // Fill the region with a random permutation cycle of word indices,
+    // so each read depends on the previous one.
+    size_t count = size / sizeof(uint64_t);
+    srand48(1);
+    for (size_t i = 0; i < count; i++) words[i] = i;
+    for (size_t i = count - 1; i > 0; i--) {
+        size_t j = testRandMod(i);  // Sattolo's algorithm: a single cycle
+        uint64_t tmp = words[i];
+        words[i] = words[j];
+        words[j] = tmp;
+    }
+
+    struct timespec start, stop;
+    uint64_t next = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int i = 0; i < options.reads; i++) next = words[next];
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double elapsed = ts2double(&stop) - ts2double(&start);
+
+    cout << (huge ? "huge" : "small") << " pages:" << endl;
+    cout << "  time: " << elapsed << " sec" << endl;
+    cout << "  avg read latency: " << elapsed / options.reads * 1e9
+        << " nsec" << endl;
+    long hugeKB = hugeMappedKB(words);
+    if (hugeKB >= 0) cout << "  huge mapped: " << hugeKB << " kB" << endl;
+    cout << "  (last index " << next << ")" << endl;
+
+    munmap(words, size);
+    close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+    // Parse command line arguments
+    int opt;
+    while ((opt = getopt(argc, argv, "m:n:HS?")) != -1) {
+        char *chptr; // character pointer for command-line parsing
+
+        switch (opt) {
+        case 'm': // region size
+            options.regionMB = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (options.regionMB < 1)) {
+                cerr << "Invalid region size specified of: " << optarg << endl;
+                exit(2);
+            }
+            break;
+
+        case 'n': // reads
+            options.reads = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (options.reads < 1)) {
+                cerr << "Invalid reads specified of: " << optarg << endl;
+                exit(3);
+            }
+            break;
+
+        case 'H': // huge pages only
+            options.small = false;
+            break;
+
+        case 'S': // regular pages only
+            options.huge = false;
+            break;
+
+        case '?':
+        default:
+            cerr << basename(argv[0]) << " [options]" << endl;
+            cerr << "  options:" << endl;
+            cerr << "    -m size - region size in MB" << endl;
+            cerr << "    -n num - random reads" << endl;
+            cerr << "    -H - huge pages only" << endl;
+            cerr << "    -S - regular pages only" << endl;
+            exit(((optopt == 0) || (optopt == '?')) ? 0 : 4);
+        }
+    }
+
+    // Display selected options
+    cout << "regionMB: " << options.regionMB << endl;
+    cout << "reads: " << options.reads << endl;
+
+    if (options.small) run(false);
+    if (options.huge) run(true);
+
+    return 0;
+}
@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Ashmem pin/unpin benchmark
+ *
+ * Measures the rate at which several threads can unpin and re-pin
+ * pages of ashmem regions, the way a cache built on ashmem does.  Each
+ * thread repeatedly unpins its own page range, touches nothing, and pins
+ * it again.  Threads either get a region each or all work on separate
+ * ranges of one shared region, which shows how much of the cost comes
+ * from contention inside the driver.
+ *
+ * This benchmark supports the following command-line options:
+ *
+ *   -t num - number of threads (default: 4)
+ *   -n num - unpin/pin pairs per thread (default: 100000)
+ *   -p pages - pages unpinned and pinned at a time (default: 1)
+ *   -s - all threads share one region (default: a region per thread)
+ *   -x - also run a thread that keeps purging all unpinned pages,
+ *        needs CAP_SYS_ADMIN (default: off)
+ */
+
+#include <cerrno>
+#include <iostream>
+#include <libgen.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <cutils/ashmem.h>
+#include "testUtil.h"
+
+typedef unsigned int __u32;
+#include <driver/ashmem/uapi_ashmem.h>
+
+using namespace std;
+
+struct options {
+    unsigned int threads;
+    unsigned int iterations;
+    unsigned int pages;
+    bool         shared;    // One region for all threads
+    bool         purge;     // Purge concurrently
+} options = { // Set defaults
+    4,       // Threads
+    100000,  // Iterations
+    1,       // Pages
+    false,   // Shared region
+    false,   // Purge
+};
+
+struct worker {
+    pthread_t thread;
+    int fd;
+    size_t offset;
+    unsigned int purged;
+    double elapsed;
+};
+
+static volatile bool stopPurging;
+static const size_t pageSize = 4096;
+
+static int createRegion(size_t size)
+{
+    int fd = ashmem_create_region("ashmemPinUnpin", size);
+    if (fd < 0) {
+        cerr << "ashmem_create_region failed, errno: " << errno << endl;
+        exit(10);
+    }
+
+    // The driver only sets up the backing file on the first mmap
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        cerr << "mmap failed, errno: " << errno << endl;
+        exit(11);
+    }
+    memset(addr, 0xa5, size);
+    return fd;
+}
+
+static void *work(void *arg)
+{
+    worker *w = (worker *) arg;
+    size_t len = options.pages * pageSize;
+    struct timespec start, stop;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int i = 0; i < options.iterations; i++) {
+        if (ashmem_unpin_region(w->fd, w->offset, len) < 0) {
+            cerr << "unpin failed, errno: " << errno << endl;
+            exit(12);
+        }
+        int rv = ashmem_pin_region(w->fd, w->offset, len);
+        if (rv < 0) {
+            cerr << "pin failed, errno: " << errno << endl;
+            exit(13);
+        }
+        if (rv == ASHMEM_WAS_PURGED) w->purged++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    w->elapsed = ts2double(&stop) - ts2double(&start);
+
+    return NULL;
+}
+
+static void *purge(void *)
+{
+    int fd = createRegion(pageSize);
+
+    while (!stopPurging) {
+        if (ioctl(fd, ASHMEM_PURGE_ALL_CACHES) < 0) {
+            cerr << "purge failed, errno: " << errno << endl;
+            exit(14);
+        }
+    }
+    close(fd);
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    // Parse command line arguments
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:p:sx?")) != -1) {
+        char *chptr; // character pointer for command-line parsing
+        unsigned long val;
+
+        switch (opt) {
+        case 't': // threads
+        case 'n': // iterations
+        case 'p': // pages
+            val = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (val < 1)) {
+                cerr << "Invalid value for -" << (char) opt
+                    << " option of: " << optarg << endl;
+                exit(2);
+            }
+            *((opt == 't') ? &options.threads : (opt == 'n')
+                ? &options.iterations : &options.pages) = val;
+            break;
+
+        case 's': // shared region
+            options.shared = true;
+            break;
+
+        case 'x': // concurrent purging
+            options.purge = true;
+            break;
+
+        case '?':
+        default:
+            cerr << basename(argv[0]) << " [options]" << endl;
+            cerr << "  options:" << endl;
+            cerr << "    -t num - threads" << endl;
+            cerr << "    -n num - unpin/pin pairs per thread" << endl;
+            cerr << "    -p pages - pages per unpin/pin" << endl;
+            cerr << "    -s - threads share one region" << endl;
+            cerr << "    -x - purge all caches concurrently" << endl;
+            exit(((optopt == 0) || (optopt == '?')) ? 0 : 3);
+        }
+    }
+
+    // Display selected options
+    cout << "threads: " << options.threads << endl;
+    cout << "iterations: " << options.iterations << endl;
+    cout << "pages: " << options.pages << endl;
+    cout << "shared: " << (options.shared ? "true" : "false") << endl;
+    cout << "purge: " << (options.purge ? "true" : "false") << endl;
+
+    size_t rangeSize = options.pages * pageSize;
+    worker *workers = new worker[options.threads];
+    int sharedFd = options.shared
+        ? createRegion(rangeSize * options.threads) : -1;
+    for (unsigned int i = 0; i < options.threads; i++) {
+        workers[i].fd = options.shared ? sharedFd : createRegion(rangeSize);
+        workers[i].offset = options.shared ? i * rangeSize : 0;
+        workers[i].purged = 0;
+    }
+
+    pthread_t purger;
+    if (options.purge) pthread_create(&purger, NULL, purge, NULL);
+    for (unsigned int i = 0; i < options.threads; i++) {
+        pthread_create(&workers[i].thread, NULL, work, &workers[i]);
+    }
+
+    double slowest = 0.0;
+    unsigned int purged = 0;
+    for (unsigned int i = 0; i < options.threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        if (workers[i].elapsed > slowest) slowest = workers[i].elapsed;
+        purged += workers[i].purged;
+    }
+    if (options.purge) {
+        stopPurging = true;
+        pthread_join(purger, NULL);
+    }
+
+    // Each iteration is an unpin and a pin
+    double ops = 2.0 * options.iterations * options.threads;
+    cout << "time: " << slowest << " sec" << endl;
+    cout << "ops/sec: " << ops / slowest << endl;
+    cout << "avg latency: " << slowest * options.threads / ops * 1e6
+        << " usec" << endl;
+    cout << "purged: " << purged << endl;
+
+    delete[] workers;
+    return 0;
+}
@@ -31,6 +31,13 @@
  *   -n num - perform IPC operation num times (default: 1000)
  *   -d time - delay specified amount of seconds after each
  *             IPC operation. (default 1e-3)
+ *   -p payload - payload size in bytes (default: 0, correctness test)
+ *   -b - also send a binder object with each parcel, so the driver
+ *        has an offsets array to copy and translate (default: off)
+ *   -r - size each request parcel up front from the proxy's record of
+ *        the previous request (default: off)
+ *   -l - serve from a Looper on the server's main thread instead of
+ *        from the binder thread pool (default: off)
  */
 
 #include <cerrno>
@@ -46,9 +53,11 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include <binder/BpBinder.h>
 #include <binder/IPCThreadState.h>
 #include <binder/ProcessState.h>
 #include <binder/IServiceManager.h>
+#include <binder/LooperBinderServer.h>
 #include <utils/Log.h>
 #include "testUtil.h"
 
@@ -65,12 +74,18 @@ struct options {
     unsigned int iterations;
     unsigned int payloadSize;
     float        iterDelay; // End of iteration delay in seconds
+    bool         sendBinder; // Attach a binder object to each parcel
+    bool         reserve;    // Pre-size requests by size prediction
+    bool         looper;     // Serve from a Looper
 } options = { // Set defaults
     unbound, // Server CPU
     unbound, // Client CPU
     1000,    // Iterations
     0,       // Payload size 
     1e-3,    // End of iteration delay
+    false,   // Send binder object
+    false,   // Reserve
+    false,   // Looper
 };
 
 class AddIntsService : public BBinder
@@ -114,7 +129,7 @@ int main(int argc, char *argv[])
 
     // Parse command line arguments
     int opt;
-    while ((opt = getopt(argc, argv, "s:c:n:d:p:?")) != -1) {
+    while ((opt = getopt(argc, argv, "s:c:n:d:p:brl?")) != -1) {
         char *chptr; // character pointer for command-line parsing
 
         switch (opt) {
@@ -169,6 +184,18 @@ int main(int argc, char *argv[])
             }
             break;
 
+        case 'b': // binder object
+            options.sendBinder = true;
+            break;
+
+        case 'r': // size prediction
+            options.reserve = true;
+            break;
+
+        case 'l': // looper
+            options.looper = true;
+            break;
+
         case '?':
         default:
             cerr << basename(argv[0]) << " [options]" << endl;
@@ -178,6 +205,9 @@ int main(int argc, char *argv[])
             cerr << "    -n num - iterations" << endl;
             cerr << "    -d time - delay after operation in seconds" << endl;
             cerr << "    -p payload - payload size (0 for correctness test)" << endl;
+            cerr << "    -b - send a binder object with each parcel" << endl;
+            cerr << "    -r - pre-size requests by size prediction" << endl;
+            cerr << "    -l - serve from a Looper" << endl;
             exit(((optopt == 0) || (optopt == '?')) ? 0 : 8);
         }
     }
@@ -204,6 +234,9 @@ int main(int argc, char *argv[])
     } else {
         cout << "mode: performance test (payload size = " << options.payloadSize << " bytes)" << endl;
     }
+    cout << "sendBinder: " << (options.sendBinder ? "yes" : "no") << endl;
+    cout << "reserve: " << (options.reserve ? "yes" : "no") << endl;
+    cout << "server: " << (options.looper ? "looper" : "thread pool") << endl;
 
     // Fork client, use this process as server
     fflush(stdout);
@@ -249,8 +282,23 @@ static void server(void)
             << " errno: " << errno << endl;
     }
 
-    // Start threads to handle server work
-    proc->startThreadPool();
+    if (!options.looper) {
+        // Start threads to handle server work
+        proc->startThreadPool();
+        return;
+    }
+
+    // Handle server work on this thread until the client exits
+    sp<Looper> looper = Looper::prepare(0);
+    sp<LooperBinderServer> looperServer = new LooperBinderServer(looper);
+    if ((rv = looperServer->start()) != 0) {
+        cerr << "LooperBinderServer start failed, rv: " << rv << endl;
+        exit(11);
+    }
+    do {
+        looper->pollOnce(100);
+    } while (waitpid(-1, NULL, WNOHANG) == 0);
+    looperServer->stop();
 }
 
 static void client(void)
@@ -272,11 +320,25 @@ static void client(void)
         usleep(500000); // 0.5 s
     } while(true);
 
+    // Object sent along with each parcel when requested
+    sp<IBinder> token;
+    if (options.sendBinder) { token = new BBinder(); }
+
+    BpBinder *proxy = binder->remoteBinder();
+    if (options.reserve && proxy != NULL) { proxy->setSizePrediction(true); }
+
+    // Only count driver traffic of the timed transactions
+    IPCThreadState::self()->resetDriverStats();
+
     // Perform the IPC operations
     for (unsigned int iter = 0; iter < options.iterations; iter++) {
         Parcel send, reply;
         int expected;
 
+        if (options.reserve && proxy != NULL) {
+            proxy->reserveRequest(AddIntsService::ADD_INTS, &send);
+        }
+
         if (options.payloadSize == 0) {
             // Create parcel to be sent.  Will use the iteration cound
             // and the iteration count + 3 as the two integer values
@@ -294,6 +356,7 @@ static void client(void)
             send.writeInt32(strlen(buf));
             send.writeCString(buf);
         }
+        if (options.sendBinder) { send.writeStrongBinder(token); }
 
         // Send the parcel, while timing how long it takes for
         // the answer to return.
@@ -331,6 +394,13 @@ static void client(void)
         << " avg: " << (total / options.iterations)
         << " max: " << max
         << endl;
+    const IPCThreadState::DriverStats& stats
+        = IPCThreadState::self()->getDriverStats();
+    cout << "Client ioctls per transaction: "
+        << (double) stats.writeReads / stats.transactionsOut
+        << " commands per ioctl: "
+        << (double) stats.commandsIn / stats.writeReads
+        << endl;
 }
 
 AddIntsService::AddIntsService(int cpu): cpu_(cpu) {
@@ -365,6 +435,11 @@ status_t AddIntsService::onTransact(uint32_t code, const Parcel &data,
         } else {
             val1 = data.readInt32();
             reply->writeInt32(val1);
+            if (options.sendBinder) { data.readCString(); }
+        }
+        if (options.sendBinder && data.readStrongBinder() == NULL) {
+            cerr << "server onTransact missing binder object" << endl;
+            exit(22);
         }
         break;
 
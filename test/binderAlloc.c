@@ -0,0 +1,546 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Binder buffer allocator benchmark
+ *
+ * Builds the driver's transaction buffer allocator
+ * (driver/binder/binder_alloc.c) in userspace on top of the shims in
+ * binderAllocShim.h, and drives it with either a recorded trace or a
+ * random sequence of allocations and frees.  At the end it reports the
+ * allocator rate and how fragmented the buffer space is.  No binder
+ * module is needed.
+ *
+ * This benchmark supports the following command-line options:
+ *
+ *   -r file - replay the binder events in an ftrace text trace
+ *             (default: run a random workload)
+ *   -p pid - only replay transactions targeting process pid
+ *            (default: all transactions, as if sent to one process)
+ *   -n num - perform num random operations (default: 100000)
+ *   -s seed - seed for the random workload (default: 1)
+ *   -m size - size in bytes of the buffer mapping
+ *             (default: 1M - 8K, the size libbinder maps)
+ *   -l pages - per-process buffer page limit, as the driver's
+ *              buffer_pages_limit parameter (default: 0, no limit)
+ *   -f - fuzz: check the allocator state after every operation and
+ *        make page allocation and mapping fail at random
+ *   -e percent - failure rate used by -f (default: 1)
+ *   -v - print the driver's debug messages
+ *
+ * A trace to replay is recorded with:
+ *
+ *   cd /sys/kernel/debug/tracing
+ *   echo 1 > events/binder/binder_transaction/enable
+ *   echo 1 > events/binder/binder_transaction_alloc_buf/enable
+ *   echo 1 > events/binder/binder_transaction_buffer_release/enable
+ *   echo 1 > events/binder/binder_transaction_failed_buffer_release/enable
+ *   cat trace_pipe > binder.trace
+ */
+
+#include <getopt.h>
+#include <libgen.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "binderAllocShim.h"
+#include "binder_alloc.h"
+
+/* The subset of the driver's struct binder_proc the allocator uses */
+struct binder_proc {
+	int pid;
+	struct vm_area_struct *vma;
+	struct mm_struct *vma_vm_mm;
+	struct task_struct *tsk;
+	void *buffer;
+	ptrdiff_t user_buffer_offset;
+
+	struct list_head buffers;
+	struct rb_root free_buffers;
+	struct rb_root allocated_buffers;
+	size_t free_async_space;
+
+	struct page **pages;
+	size_t pages_allocated;
+	size_t pages_high_water;
+	struct mem_cgroup *memcg;
+	size_t buffer_size;
+};
+
+#define binder_debug(mask, x...) pr_info(x)
+#define binder_user_error(x...) pr_info(x)
+
+static unsigned int binder_buffer_pages_limit;
+
+#include "binder_alloc.c"
+
+bool shim_verbose;
+size_t shim_pages_live;
+unsigned int shim_fail_percent;
+
+#define TF_ONE_WAY 0x01
+
+struct options {
+    const char *traceFile;
+    int pid;
+    unsigned long iterations;
+    long seed;
+    size_t mapSize;
+    unsigned int pagesLimit;
+    bool fuzz;
+    unsigned int failPercent;
+} options = { // Set defaults
+    NULL,                            // Trace file
+    -1,                              // Target process
+    100000,                          // Iterations
+    1,                               // Seed
+    (1 * 1024 * 1024) - (4096 * 2),  // Mapping size
+    0,                               // Page limit
+    false,                           // Fuzz
+    1,                               // Failure percent
+};
+
+struct results {
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long failed[3];  // No space, over limit, other
+    double allocTime;
+    double freeTime;
+    size_t peakLive;
+    double peakFragmentation;
+} results;
+
+/*
+ * Buffers handed out by the allocator, indexed by transaction id so a
+ * trace can find the buffer a release refers to.
+ */
+struct live {
+    unsigned int id;
+    bool async;
+    struct binder_buffer *buffer;
+    struct live *next;
+    struct live **pprev;
+};
+
+#define LIVE_HASH_SIZE 4096
+static struct live *liveHash[LIVE_HASH_SIZE];
+static struct live **liveArray;   // For picking a random buffer to free
+static size_t liveCount, liveCapacity;
+static size_t asyncInUse;
+
+static struct binder_proc proc;
+static struct task_struct task;
+static struct mm_struct mm;
+static struct vm_area_struct vma;
+static struct mem_cgroup memcg;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t allocSize(struct binder_buffer *buffer)
+{
+    return ALIGN(buffer->data_size, sizeof(void *)) +
+        ALIGN(buffer->offsets_size, sizeof(void *));
+}
+
+static struct live *liveFind(unsigned int id)
+{
+    struct live *l;
+
+    for (l = liveHash[id % LIVE_HASH_SIZE]; l; l = l->next) {
+        if (l->id == id) return l;
+    }
+    return NULL;
+}
+
+static struct live *liveAdd(unsigned int id, bool async)
+{
+    struct live *l = calloc(1, sizeof(*l));
+    struct live **head = &liveHash[id % LIVE_HASH_SIZE];
+
+    l->id = id;
+    l->async = async;
+    l->next = *head;
+    l->pprev = head;
+    if (*head) (*head)->pprev = &l->next;
+    *head = l;
+    return l;
+}
+
+static void liveRemove(struct live *l)
+{
+    *l->pprev = l->next;
+    if (l->next) l->next->pprev = l->pprev;
+    free(l);
+}
+
+/*
+ * Largest free buffer as a fraction of all free space; 0 means all free
+ * space is in one piece.
+ */
+static double fragmentation(size_t *freeBytes, size_t *largest)
+{
+    struct list_head *pos;
+    struct rb_node *n;
+
+    *freeBytes = 0;
+    for (pos = proc.buffers.next; pos != &proc.buffers; pos = pos->next) {
+        struct binder_buffer *buffer =
+            list_entry(pos, struct binder_buffer, entry);
+        if (buffer->free) *freeBytes += binder_buffer_size(&proc, buffer);
+    }
+    n = rb_last(&proc.free_buffers);
+    *largest = n ? binder_buffer_size(&proc,
+        rb_entry(n, struct binder_buffer, rb_node)) : 0;
+    return *freeBytes ? 1.0 - (double)*largest / *freeBytes : 0.0;
+}
+
+static void mapBuffer(void)
+{
+    proc.pid = getpid();
+    proc.tsk = &task;
+    task.mm = &mm;
+    vma.vm_mm = &mm;
+    proc.buffer_size = options.mapSize & PAGE_MASK;
+    proc.buffer = mmap(NULL, proc.buffer_size, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (proc.buffer == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    proc.pages = calloc(proc.buffer_size / PAGE_SIZE, sizeof(proc.pages[0]));
+    proc.free_buffers = RB_ROOT;
+    proc.allocated_buffers = RB_ROOT;
+    proc.memcg = &memcg;
+
+    // Same steps as binder_mmap()
+    shim_fail_percent = 0;
+    if (binder_update_page_range(&proc, 1, proc.buffer,
+                                 proc.buffer + PAGE_SIZE, &vma)) {
+        fprintf(stderr, "failed to map the first page\n");
+        exit(1);
+    }
+    INIT_LIST_HEAD(&proc.buffers);
+    list_add(&((struct binder_buffer *)proc.buffer)->entry, &proc.buffers);
+    ((struct binder_buffer *)proc.buffer)->free = 1;
+    binder_insert_free_buffer(&proc, proc.buffer);
+    proc.free_async_space = proc.buffer_size / 2;
+    proc.vma = &vma;
+    proc.vma_vm_mm = &mm;
+    shim_fail_percent = options.fuzz ? options.failPercent : 0;
+}
+
+/*
+ * Walks every buffer and checks that the address list, both trees, the
+ * page array, the async space and the buffer contents agree.
+ */
+static void check(void)
+{
+    struct list_head *pos;
+    struct rb_node *n;
+    struct binder_buffer *prev = NULL;
+    size_t freeCount = 0, allocatedCount = 0, pages = 0, treeCount, i;
+    size_t lastSize = 0;
+
+    BUG_ON(proc.buffers.next != &((struct binder_buffer *)proc.buffer)->entry);
+    for (pos = proc.buffers.next; pos != &proc.buffers; pos = pos->next) {
+        struct binder_buffer *buffer =
+            list_entry(pos, struct binder_buffer, entry);
+        size_t size = binder_buffer_size(&proc, buffer);
+        uintptr_t page, end;
+
+        BUG_ON(prev && buffer <= prev);
+        BUG_ON(prev && prev->free && buffer->free);
+        BUG_ON((void *)buffer->data + size > proc.buffer + proc.buffer_size);
+        end = (uintptr_t)buffer->data;
+        if (buffer->free) {
+            freeCount++;
+        } else {
+            allocatedCount++;
+            BUG_ON(allocSize(buffer) > size);
+            end += allocSize(buffer);
+            for (i = 0; i < allocSize(buffer); i++)
+                BUG_ON(buffer->data[i] != (uint8_t)buffer->debug_id);
+        }
+        // The header and anything handed out must be backed by pages
+        for (page = (uintptr_t)buffer & PAGE_MASK; page < end;
+             page += PAGE_SIZE)
+            BUG_ON(!proc.pages[(page - (uintptr_t)proc.buffer) / PAGE_SIZE]);
+        prev = buffer;
+    }
+
+    treeCount = 0;
+    for (n = rb_first(&proc.free_buffers); n; n = rb_next(n)) {
+        struct binder_buffer *buffer =
+            rb_entry(n, struct binder_buffer, rb_node);
+        size_t size = binder_buffer_size(&proc, buffer);
+
+        BUG_ON(!buffer->free);
+        BUG_ON(size < lastSize);
+        lastSize = size;
+        treeCount++;
+    }
+    BUG_ON(treeCount != freeCount);
+
+    treeCount = 0;
+    prev = NULL;
+    for (n = rb_first(&proc.allocated_buffers); n; n = rb_next(n)) {
+        struct binder_buffer *buffer =
+            rb_entry(n, struct binder_buffer, rb_node);
+
+        BUG_ON(buffer->free);
+        BUG_ON(prev && buffer <= prev);
+        prev = buffer;
+        treeCount++;
+    }
+    BUG_ON(treeCount != allocatedCount);
+    BUG_ON(allocatedCount != liveCount);
+
+    for (i = 0; i < proc.buffer_size / PAGE_SIZE; i++)
+        if (proc.pages[i]) pages++;
+    BUG_ON(pages != proc.pages_allocated);
+    BUG_ON(pages != shim_pages_live);
+    BUG_ON(pages != memcg.pages);
+    BUG_ON(binder_buffer_pages_limit && pages > binder_buffer_pages_limit);
+    BUG_ON(proc.free_async_space + asyncInUse != proc.buffer_size / 2);
+}
+
+static void sample(void)
+{
+    size_t freeBytes, largest;
+    double frag;
+
+    if (liveCount > results.peakLive) results.peakLive = liveCount;
+    if ((results.allocs + results.frees) % 256 == 0 || options.fuzz) {
+        frag = fragmentation(&freeBytes, &largest);
+        if (frag > results.peakFragmentation) results.peakFragmentation = frag;
+    }
+    if (options.fuzz) check();
+}
+
+static struct binder_buffer *doAlloc(struct live *l, size_t dataSize,
+                                     size_t offsetsSize)
+{
+    struct binder_buffer *buffer;
+    double start = now();
+
+    buffer = binder_alloc_buf(&proc, dataSize, offsetsSize, l->async);
+    results.allocTime += now() - start;
+    results.allocs++;
+    if (IS_ERR(buffer)) {
+        switch (PTR_ERR(buffer)) {
+        case -ENOSPC: results.failed[0]++; break;
+        case -EDQUOT: results.failed[1]++; break;
+        default: results.failed[2]++; break;
+        }
+        return NULL;
+    }
+
+    buffer->transaction = NULL;
+    buffer->target_node = NULL;
+    buffer->debug_id = l->id;
+    if (options.fuzz) memset(buffer->data, (uint8_t)l->id, allocSize(buffer));
+    if (l->async) asyncInUse += allocSize(buffer) + sizeof(*buffer);
+    if (liveCount == liveCapacity) {
+        liveCapacity = liveCapacity ? liveCapacity * 2 : 256;
+        liveArray = realloc(liveArray, liveCapacity * sizeof(liveArray[0]));
+    }
+    liveArray[liveCount++] = l;
+    l->buffer = buffer;
+    return buffer;
+}
+
+static void doFree(struct live *l)
+{
+    size_t i;
+    double start;
+
+    if (l->async) asyncInUse -= allocSize(l->buffer) + sizeof(*l->buffer);
+    start = now();
+    binder_free_buf(&proc, l->buffer);
+    results.freeTime += now() - start;
+    results.frees++;
+    for (i = 0; i < liveCount; i++) {
+        if (liveArray[i] == l) {
+            liveArray[i] = liveArray[--liveCount];
+            break;
+        }
+    }
+    liveRemove(l);
+}
+
+/*
+ * Random workload: parcel sizes are mostly small with an occasional
+ * large one, about a fifth of the calls are oneway, and the number of
+ * outstanding buffers drifts so the allocator sees both a nearly empty
+ * and a nearly full buffer space.
+ */
+static void runRandom(void)
+{
+    static const size_t sizes[] = { 16, 64, 100, 256, 1024, 4000, 16384 };
+    unsigned long op;
+    unsigned int id = 1;
+
+    srand48(options.seed);
+    for (op = 0; op < options.iterations; op++) {
+        bool doAllocate = liveCount == 0 ||
+            (size_t)(lrand48() % 100) < (op / 10000 % 2 ? 40 : 60);
+
+        if (doAllocate) {
+            size_t dataSize = sizes[lrand48() % 7];
+            size_t offsetsSize = (lrand48() % 4) * sizeof(void *);
+            struct live *l;
+
+            if (lrand48() % 16 == 0) dataSize = lrand48() % 65536;
+            dataSize += lrand48() % 32;
+            l = liveAdd(id++, lrand48() % 5 == 0);
+            if (!doAlloc(l, dataSize, offsetsSize)) liveRemove(l);
+        } else {
+            doFree(liveArray[lrand48() % liveCount]);
+        }
+        sample();
+    }
+}
+
+/*
+ * Replays the buffer events of an ftrace text trace.  The transaction
+ * event comes first and says whether the buffer is async and which
+ * process it is for, then the alloc_buf event gives its size, and a
+ * buffer_release event with the same transaction id frees it.
+ */
+static void runTrace(void)
+{
+    FILE *f = fopen(options.traceFile, "r");
+    char line[512];
+    const char *event;
+
+    if (!f) {
+        perror(options.traceFile);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), f)) {
+        unsigned int id, reply, flags;
+        int destProc;
+        size_t dataSize, offsetsSize;
+        struct live *l;
+
+        if ((event = strstr(line, "binder_transaction: ")) &&
+            sscanf(event, "binder_transaction: transaction=%u dest_node=%*d "
+                   "dest_proc=%d dest_thread=%*d reply=%u flags=0x%x",
+                   &id, &destProc, &reply, &flags) == 4) {
+            if (options.pid < 0 || destProc == options.pid)
+                liveAdd(id, !reply && (flags & TF_ONE_WAY));
+        } else if ((event = strstr(line, "binder_transaction_alloc_buf: ")) &&
+                   sscanf(event, "binder_transaction_alloc_buf: transaction=%u "
+                          "data_size=%zu offsets_size=%zu",
+                          &id, &dataSize, &offsetsSize) == 3) {
+            l = liveFind(id);
+            if (l && !l->buffer && !doAlloc(l, dataSize, offsetsSize))
+                liveRemove(l);
+            else if (l) sample();
+        } else if (((event = strstr(line, "binder_transaction_buffer_release: ")) ||
+                    (event = strstr(line, "binder_transaction_failed_buffer_release: "))) &&
+                   sscanf(strstr(event, "transaction="), "transaction=%u",
+                          &id) == 1) {
+            l = liveFind(id);
+            if (l && l->buffer) {
+                doFree(l);
+                sample();
+            }
+        }
+    }
+    fclose(f);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    size_t freeBytes, largest;
+    double frag, elapsed;
+
+    while ((opt = getopt(argc, argv, "r:p:n:s:m:l:fe:v?")) != -1) {
+        char *chptr; // character pointer for command-line parsing
+
+        switch (opt) {
+        case 'r': options.traceFile = optarg; break;
+        case 'p': options.pid = strtol(optarg, &chptr, 10); break;
+        case 'n': options.iterations = strtoul(optarg, &chptr, 10); break;
+        case 's': options.seed = strtol(optarg, &chptr, 10); break;
+        case 'm': options.mapSize = strtoul(optarg, &chptr, 10); break;
+        case 'l': options.pagesLimit = strtoul(optarg, &chptr, 10); break;
+        case 'f': options.fuzz = true; break;
+        case 'e': options.failPercent = strtoul(optarg, &chptr, 10); break;
+        case 'v': shim_verbose = true; break;
+
+        case '?':
+        default:
+            fprintf(stderr, "    %s [options]\n", basename(argv[0]));
+            fprintf(stderr, "      -r file - Replay ftrace binder events\n");
+            fprintf(stderr, "      -p pid - Only replay transactions to pid\n");
+            fprintf(stderr, "      -n num - Random operations\n");
+            fprintf(stderr, "      -s seed - Random seed\n");
+            fprintf(stderr, "      -m size - Buffer mapping size in bytes\n");
+            fprintf(stderr, "      -l pages - Buffer page limit\n");
+            fprintf(stderr, "      -f - Fuzz: check state, inject failures\n");
+            fprintf(stderr, "      -e percent - Failure rate for -f\n");
+            fprintf(stderr, "      -v - Print driver debug messages\n");
+            exit(((optopt == 0) || (optopt == '?')) ? 0 : 1);
+        }
+    }
+    if (options.mapSize < PAGE_SIZE) {
+        fprintf(stderr, "mapping size must be at least one page\n");
+        exit(1);
+    }
+
+    binder_buffer_pages_limit = options.pagesLimit;
+    mapBuffer();
+    if (options.traceFile) runTrace();
+    else runRandom();
+
+    frag = fragmentation(&freeBytes, &largest);
+    elapsed = results.allocTime + results.freeTime;
+    printf("mapSize: %zu\n", proc.buffer_size);
+    printf("allocs: %lu frees: %lu\n", results.allocs, results.frees);
+    printf("failed: %lu no space, %lu over limit, %lu other\n",
+           results.failed[0], results.failed[1], results.failed[2]);
+    printf("ops/sec: %.0f (alloc %.1f ns, free %.1f ns)\n",
+           elapsed > 0 ? (results.allocs + results.frees) / elapsed : 0.0,
+           results.allocs ? results.allocTime / results.allocs * 1e9 : 0.0,
+           results.frees ? results.freeTime / results.frees * 1e9 : 0.0);
+    printf("live buffers: %zu (peak %zu)\n", liveCount, results.peakLive);
+    printf("pages: %zu (high water %zu)\n", proc.pages_allocated,
+           proc.pages_high_water);
+    printf("free: %zu bytes, largest %zu\n", freeBytes, largest);
+    printf("fragmentation: %.3f (peak %.3f)\n", frag,
+           results.peakFragmentation);
+
+    if (options.fuzz) {
+        shim_fail_percent = 0;
+        while (liveCount) {
+            doFree(liveArray[liveCount - 1]);
+            check();
+        }
+        // With everything freed only the first page may stay mapped
+        BUG_ON(proc.pages_allocated > 1);
+        printf("fuzz: ok\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,496 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Userspace stand-ins for the kernel interfaces used by
+ * driver/binder/binder_alloc.c, so that the allocator can be built
+ * into an ordinary program (see binderAlloc.c).
+ *
+ * The "kernel" side of the binder buffer is a PROT_NONE reservation.
+ * Mapping a page makes it read/write and unmapping it drops the contents
+ * and makes it inaccessible again, so the allocator touching a page it
+ * has not mapped faults just like it would in the kernel.  The user side
+ * of the mapping is not modelled.
+ */
+
+#ifndef _BINDER_ALLOC_SHIM_H_
+#define _BINDER_ALLOC_SHIM_H_
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define PAGE_SIZE	((size_t)4096)
+#define PAGE_MASK	(~(PAGE_SIZE - 1))
+#define ALIGN(x, a)	(((x) + (a) - 1) & ~((__typeof__(x))(a) - 1))
+#define PAGE_ALIGN(addr) ALIGN(addr, PAGE_SIZE)
+
+#define BUG_ON(cond) do { \
+		if (cond) { \
+			fprintf(stderr, "BUG at %s:%d: %s\n", \
+				__FILE__, __LINE__, #cond); \
+			abort(); \
+		} \
+	} while (0)
+#define BUG() BUG_ON(1)
+
+extern bool shim_verbose;
+
+#define pr_info(x...) do { if (shim_verbose) fprintf(stderr, x); } while (0)
+#define pr_err(x...) pr_info(x)
+
+/* Error pointers */
+
+#define MAX_ERRNO	4095
+
+static inline void *ERR_PTR(long error)
+{
+	return (void *)error;
+}
+
+static inline long PTR_ERR(const void *ptr)
+{
+	return (long)ptr;
+}
+
+static inline bool IS_ERR(const void *ptr)
+{
+	return (unsigned long)ptr >= (unsigned long)-MAX_ERRNO;
+}
+
+/* Lists */
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+	new->next = head->next;
+	new->prev = head;
+	head->next->prev = new;
+	head->next = new;
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	entry->next = NULL;
+	entry->prev = NULL;
+}
+
+static inline int list_is_last(const struct list_head *list,
+			       const struct list_head *head)
+{
+	return list->next == head;
+}
+
+/* Red-black trees, same interface as <linux/rbtree.h> */
+
+#define RB_RED		0
+#define RB_BLACK	1
+
+struct rb_node {
+	struct rb_node *rb_parent;
+	int rb_color;
+	struct rb_node *rb_right;
+	struct rb_node *rb_left;
+};
+
+struct rb_root {
+	struct rb_node *rb_node;
+};
+
+#define RB_ROOT		(struct rb_root) { NULL, }
+#define rb_entry(ptr, type, member) container_of(ptr, type, member)
+
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent,
+				struct rb_node **rb_link)
+{
+	node->rb_parent = parent;
+	node->rb_color = RB_RED;
+	node->rb_left = node->rb_right = NULL;
+	*rb_link = node;
+}
+
+static inline int rb_is_red(struct rb_node *node)
+{
+	return node && node->rb_color == RB_RED;
+}
+
+static inline void rb_replace_child(struct rb_root *root,
+				    struct rb_node *old, struct rb_node *new)
+{
+	struct rb_node *parent = old->rb_parent;
+
+	if (!parent)
+		root->rb_node = new;
+	else if (parent->rb_left == old)
+		parent->rb_left = new;
+	else
+		parent->rb_right = new;
+	if (new)
+		new->rb_parent = parent;
+}
+
+static inline void rb_rotate_left(struct rb_root *root, struct rb_node *node)
+{
+	struct rb_node *right = node->rb_right;
+
+	node->rb_right = right->rb_left;
+	if (right->rb_left)
+		right->rb_left->rb_parent = node;
+	rb_replace_child(root, node, right);
+	right->rb_left = node;
+	node->rb_parent = right;
+}
+
+static inline void rb_rotate_right(struct rb_root *root, struct rb_node *node)
+{
+	struct rb_node *left = node->rb_left;
+
+	node->rb_left = left->rb_right;
+	if (left->rb_right)
+		left->rb_right->rb_parent = node;
+	rb_replace_child(root, node, left);
+	left->rb_right = node;
+	node->rb_parent = left;
+}
+
+static inline void rb_insert_color(struct rb_node *node, struct rb_root *root)
+{
+	struct rb_node *parent, *gparent, *uncle;
+
+	while ((parent = node->rb_parent) && parent->rb_color == RB_RED) {
+		gparent = parent->rb_parent;
+		if (parent == gparent->rb_left) {
+			uncle = gparent->rb_right;
+			if (rb_is_red(uncle)) {
+				parent->rb_color = RB_BLACK;
+				uncle->rb_color = RB_BLACK;
+				gparent->rb_color = RB_RED;
+				node = gparent;
+				continue;
+			}
+			if (node == parent->rb_right) {
+				rb_rotate_left(root, parent);
+				node = parent;
+				parent = node->rb_parent;
+			}
+			parent->rb_color = RB_BLACK;
+			gparent->rb_color = RB_RED;
+			rb_rotate_right(root, gparent);
+		} else {
+			uncle = gparent->rb_left;
+			if (rb_is_red(uncle)) {
+				parent->rb_color = RB_BLACK;
+				uncle->rb_color = RB_BLACK;
+				gparent->rb_color = RB_RED;
+				node = gparent;
+				continue;
+			}
+			if (node == parent->rb_left) {
+				rb_rotate_right(root, parent);
+				node = parent;
+				parent = node->rb_parent;
+			}
+			parent->rb_color = RB_BLACK;
+			gparent->rb_color = RB_RED;
+			rb_rotate_left(root, gparent);
+		}
+	}
+	root->rb_node->rb_color = RB_BLACK;
+}
+
+static inline void rb_erase_fixup(struct rb_node *node, struct rb_node *parent,
+				  struct rb_root *root)
+{
+	struct rb_node *sibling;
+
+	while (node != root->rb_node && !rb_is_red(node)) {
+		if (node == parent->rb_left) {
+			sibling = parent->rb_right;
+			if (rb_is_red(sibling)) {
+				sibling->rb_color = RB_BLACK;
+				parent->rb_color = RB_RED;
+				rb_rotate_left(root, parent);
+				sibling = parent->rb_right;
+			}
+			if (!rb_is_red(sibling->rb_left) &&
+			    !rb_is_red(sibling->rb_right)) {
+				sibling->rb_color = RB_RED;
+				node = parent;
+				parent = node->rb_parent;
+				continue;
+			}
+			if (!rb_is_red(sibling->rb_right)) {
+				sibling->rb_left->rb_color = RB_BLACK;
+				sibling->rb_color = RB_RED;
+				rb_rotate_right(root, sibling);
+				sibling = parent->rb_right;
+			}
+			sibling->rb_color = parent->rb_color;
+			parent->rb_color = RB_BLACK;
+			sibling->rb_right->rb_color = RB_BLACK;
+			rb_rotate_left(root, parent);
+		} else {
+			sibling = parent->rb_left;
+			if (rb_is_red(sibling)) {
+				sibling->rb_color = RB_BLACK;
+				parent->rb_color = RB_RED;
+				rb_rotate_right(root, parent);
+				sibling = parent->rb_left;
+			}
+			if (!rb_is_red(sibling->rb_left) &&
+			    !rb_is_red(sibling->rb_right)) {
+				sibling->rb_color = RB_RED;
+				node = parent;
+				parent = node->rb_parent;
+				continue;
+			}
+			if (!rb_is_red(sibling->rb_left)) {
+				sibling->rb_right->rb_color = RB_BLACK;
+				sibling->rb_color = RB_RED;
+				rb_rotate_left(root, sibling);
+				sibling = parent->rb_left;
+			}
+			sibling->rb_color = parent->rb_color;
+			parent->rb_color = RB_BLACK;
+			sibling->rb_left->rb_color = RB_BLACK;
+			rb_rotate_right(root, parent);
+		}
+		node = root->rb_node;
+		break;
+	}
+	if (node)
+		node->rb_color = RB_BLACK;
+}
+
+static inline void rb_erase(struct rb_node *node, struct rb_root *root)
+{
+	struct rb_node *child, *parent, *next;
+	int color = node->rb_color;
+
+	if (!node->rb_left || !node->rb_right) {
+		child = node->rb_left ? node->rb_left : node->rb_right;
+		parent = node->rb_parent;
+		rb_replace_child(root, node, child);
+	} else {
+		next = node->rb_right;
+		while (next->rb_left)
+			next = next->rb_left;
+		color = next->rb_color;
+		child = next->rb_right;
+		if (next->rb_parent == node) {
+			parent = next;
+		} else {
+			parent = next->rb_parent;
+			rb_replace_child(root, next, child);
+			next->rb_right = node->rb_right;
+			next->rb_right->rb_parent = next;
+		}
+		rb_replace_child(root, node, next);
+		next->rb_left = node->rb_left;
+		next->rb_left->rb_parent = next;
+		next->rb_color = node->rb_color;
+	}
+	if (color == RB_BLACK)
+		rb_erase_fixup(child, parent, root);
+}
+
+static inline struct rb_node *rb_first(const struct rb_root *root)
+{
+	struct rb_node *n = root->rb_node;
+
+	if (!n)
+		return NULL;
+	while (n->rb_left)
+		n = n->rb_left;
+	return n;
+}
+
+static inline struct rb_node *rb_last(const struct rb_root *root)
+{
+	struct rb_node *n = root->rb_node;
+
+	if (!n)
+		return NULL;
+	while (n->rb_right)
+		n = n->rb_right;
+	return n;
+}
+
+static inline struct rb_node *rb_next(const struct rb_node *node)
+{
+	struct rb_node *parent;
+
+	if (node->rb_right) {
+		node = node->rb_right;
+		while (node->rb_left)
+			node = node->rb_left;
+		return (struct rb_node *)node;
+	}
+	while ((parent = node->rb_parent) && node == parent->rb_right)
+		node = parent;
+	return parent;
+}
+
+/* Memory management */
+
+#define GFP_KERNEL	0
+#define __GFP_HIGHMEM	0
+#define __GFP_ZERO	0
+#define PAGE_KERNEL	0
+
+struct page {
+	int unused;
+};
+
+struct rw_semaphore {
+	int unused;
+};
+
+struct mm_struct {
+	struct rw_semaphore mmap_sem;
+};
+
+struct vm_area_struct {
+	struct mm_struct *vm_mm;
+};
+
+struct task_struct {
+	struct mm_struct *mm;
+};
+
+struct mem_cgroup {
+	size_t pages;	/* charged and not yet uncharged */
+};
+
+/*
+ * Counters and fault injection shared with the test program.
+ * shim_fail_percent makes page allocation, memcg charging and mapping
+ * fail at random so the allocator's unwind paths get exercised.
+ */
+extern size_t shim_pages_live;
+extern unsigned int shim_fail_percent;
+
+static inline bool shim_should_fail(void)
+{
+	return shim_fail_percent && (unsigned int)(lrand48() % 100) <
+		shim_fail_percent;
+}
+
+static inline struct mm_struct *get_task_mm(struct task_struct *task)
+{
+	return task->mm;
+}
+
+static inline void mmput(struct mm_struct *mm)
+{
+}
+
+static inline void down_write(struct rw_semaphore *sem)
+{
+}
+
+static inline void up_write(struct rw_semaphore *sem)
+{
+}
+
+static inline struct page *alloc_page(int gfp_mask)
+{
+	struct page *page;
+
+	if (shim_should_fail())
+		return NULL;
+	page = malloc(sizeof(*page));
+	if (page)
+		shim_pages_live++;
+	return page;
+}
+
+static inline void __free_page(struct page *page)
+{
+	shim_pages_live--;
+	free(page);
+}
+
+static inline int memcg_charge_kmem(struct mem_cgroup *memcg, int gfp,
+				    unsigned long nr_pages)
+{
+	if (shim_should_fail())
+		return -ENOMEM;
+	memcg->pages += nr_pages;
+	return 0;
+}
+
+static inline void memcg_uncharge_kmem(struct mem_cgroup *memcg,
+				       unsigned long nr_pages)
+{
+	memcg->pages -= nr_pages;
+}
+
+static inline int map_kernel_range_noflush(unsigned long start,
+					   unsigned long size, int prot,
+					   struct page **pages)
+{
+	if (shim_should_fail())
+		return -ENOMEM;
+	if (mprotect((void *)start, size, PROT_READ | PROT_WRITE))
+		return -errno;
+	return size / PAGE_SIZE;
+}
+
+static inline void unmap_kernel_range(unsigned long addr, unsigned long size)
+{
+	madvise((void *)addr, size, MADV_DONTNEED);
+	mprotect((void *)addr, size, PROT_NONE);
+}
+
+static inline void flush_cache_vmap(unsigned long start, unsigned long end)
+{
+}
+
+static inline int vm_insert_page(struct vm_area_struct *vma,
+				 unsigned long addr, struct page *page)
+{
+	return shim_should_fail() ? -ENOMEM : 0;
+}
+
+static inline void zap_page_range(struct vm_area_struct *vma,
+				  unsigned long address, unsigned long size,
+				  void *details)
+{
+}
+
+#define trace_binder_update_page_range(proc, allocate, start, end) \
+	do { } while (0)
+
+#endif /* _BINDER_ALLOC_SHIM_H_ */
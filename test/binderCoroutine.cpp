@@ -0,0 +1,447 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Binder coroutine benchmark
+ *
+ * Example of a service whose proxy offers a co_await-able method next to
+ * the usual blocking one, and a measure of how a client keeps many calls
+ * to it in flight.  Each round the client makes a number of concurrent
+ * add requests spread over several instances of the service, first with
+ * one thread per request blocked in transact(), then with one coroutine
+ * per request awaiting the reply and no threads of its own.  Each request
+ * takes a fixed amount of time in the service, sleeping rather than
+ * spinning.  The services live in a forked server process.
+ *
+ * This benchmark supports the following command-line options:
+ *
+ *   -c num - concurrent requests per round (default: 1000)
+ *   -s num - number of service instances (default: 16)
+ *   -n num - rounds per mode (default: 10)
+ *   -d time - time each request takes in the service, in seconds
+ *             (default: 1e-3)
+ *   -l - resume coroutines on a Looper thread rather than on the
+ *        binder thread that received the reply (default: off)
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <iostream>
+#include <libgen.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <binder/BinderCoroutine.h>
+#include <binder/IInterface.h>
+#include <binder/IPCThreadState.h>
+#include <binder/ProcessState.h>
+#include <binder/IServiceManager.h>
+#include <utils/Condition.h>
+#include <utils/Looper.h>
+#include <utils/Mutex.h>
+#include <utils/String8.h>
+#include "testUtil.h"
+
+using namespace android;
+using namespace std;
+
+struct options {
+    unsigned int concurrency;
+    unsigned int services;
+    unsigned int rounds;
+    float        work;      // Service time per request in seconds
+    bool         looper;    // Resume coroutines on a Looper
+} options = { // Set defaults
+    1000,    // Concurrency
+    16,      // Services
+    10,      // Rounds
+    1e-3,    // Service time
+    false,   // Looper
+};
+
+// ----------------------------------------------------------------------------
+// Example service
+
+class ICoroAdder : public IInterface
+{
+public:
+    DECLARE_META_INTERFACE(CoroAdder);
+
+    enum {
+        ADD = IBinder::FIRST_CALL_TRANSACTION,
+    };
+
+    // Blocks the calling thread until the sum comes back.
+    virtual int32_t add(int32_t a, int32_t b) = 0;
+
+    // Same call for a coroutine; *sum is set once the task completes.
+    virtual BinderTask<status_t> addAsync(int32_t a, int32_t b, int32_t* sum,
+            AwaitExecutor* executor = BinderPoolExecutor::get()) = 0;
+};
+
+class BpCoroAdder : public BpInterface<ICoroAdder>
+{
+public:
+    BpCoroAdder(const sp<IBinder>& impl) : BpInterface<ICoroAdder>(impl) { }
+
+    virtual int32_t add(int32_t a, int32_t b)
+    {
+        Parcel data, reply;
+        data.writeInterfaceToken(ICoroAdder::getInterfaceDescriptor());
+        data.writeInt32(a);
+        data.writeInt32(b);
+        if (remote()->transact(ADD, data, &reply) != NO_ERROR) {
+            return -1;
+        }
+        return reply.readInt32();
+    }
+
+    virtual BinderTask<status_t> addAsync(int32_t a, int32_t b, int32_t* sum,
+            AwaitExecutor* executor)
+    {
+        Parcel data, reply;
+        data.writeInterfaceToken(ICoroAdder::getInterfaceDescriptor());
+        data.writeInt32(a);
+        data.writeInt32(b);
+        status_t err = co_await awaitTransact(remote(), ADD, data, &reply, executor);
+        if (err == NO_ERROR) {
+            *sum = reply.readInt32();
+        }
+        co_return err;
+    }
+};
+
+IMPLEMENT_META_INTERFACE(CoroAdder, "test.ICoroAdder");
+
+class BnCoroAdder : public BnInterface<ICoroAdder>
+{
+public:
+    virtual status_t onTransact(uint32_t code, const Parcel& data,
+                                Parcel* reply, uint32_t flags = 0)
+    {
+        switch (code) {
+        case ADD: {
+            CHECK_INTERFACE(ICoroAdder, data, reply);
+            int32_t a = data.readInt32();
+            int32_t b = data.readInt32();
+            reply->writeInt32(add(a, b));
+            return NO_ERROR;
+        }
+        default:
+            return BBinder::onTransact(code, data, reply, flags);
+        }
+    }
+};
+
+class CoroAdder : public BnCoroAdder
+{
+public:
+    virtual int32_t add(int32_t a, int32_t b)
+    {
+        struct timespec ts;
+        ts.tv_sec = (time_t) options.work;
+        ts.tv_nsec = (long) ((options.work - ts.tv_sec) * 1e9);
+        nanosleep(&ts, NULL);
+        return a + b;
+    }
+
+    virtual BinderTask<status_t> addAsync(int32_t a, int32_t b, int32_t* sum,
+            AwaitExecutor*)
+    {
+        *sum = add(a, b);
+        co_return NO_ERROR;
+    }
+};
+
+// ----------------------------------------------------------------------------
+
+// Requests of one round still outstanding.
+class Round
+{
+public:
+    Round(unsigned int count, const sp<Looper>& looper)
+        : mRemaining(count), mLooper(looper) { }
+
+    void finished()
+    {
+        if (mLooper != NULL) {
+            --mRemaining;
+            return;
+        }
+        // Under the lock, so wait() cannot return and take the round
+        // away before the signal is sent.
+        AutoMutex _l(mLock);
+        if (--mRemaining == 0) {
+            mDone.signal();
+        }
+    }
+
+    void wait()
+    {
+        if (mLooper != NULL) {
+            while (mRemaining > 0) {
+                mLooper->pollOnce(-1);
+            }
+        } else {
+            AutoMutex _l(mLock);
+            while (mRemaining > 0) {
+                mDone.wait(mLock);
+            }
+        }
+    }
+
+private:
+    std::atomic<unsigned int> mRemaining;
+    sp<Looper>          mLooper;
+    Mutex               mLock;
+    Condition           mDone;
+};
+
+struct request {
+    sp<ICoroAdder> adder;
+    int32_t        n;
+};
+
+static String16 serviceName(unsigned int n)
+{
+    return String16(String8::format("test.binderCoroutine.%u", n));
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts2double(&ts);
+}
+
+static void check(int32_t n, status_t err, int32_t sum)
+{
+    if (err != NO_ERROR || sum != n + 1) {
+        cerr << "add " << n << " failed, rv: " << err << " sum: " << sum << endl;
+        exit(12);
+    }
+}
+
+static void *blockingRequest(void *arg)
+{
+    request *req = (request *) arg;
+    int32_t sum = req->adder->add(req->n, 1);
+    check(req->n, sum == -1 ? UNKNOWN_ERROR : NO_ERROR, sum);
+    return NULL;
+}
+
+static BinderTask<> coroutineRequest(sp<ICoroAdder> adder, int32_t n,
+                                     AwaitExecutor* executor, Round* round)
+{
+    int32_t sum = 0;
+    status_t err = co_await adder->addAsync(n, 1, &sum, executor);
+    check(n, err, sum);
+    round->finished();
+}
+
+static void server(void)
+{
+    int rv;
+
+    sp<ProcessState> proc(ProcessState::self());
+    sp<IServiceManager> sm = defaultServiceManager();
+    for (unsigned int n = 0; n < options.services; n++) {
+        if ((rv = sm->addService(serviceName(n), new CoroAdder())) != 0) {
+            cerr << "addService " << n << " failed, rv: " << rv
+                << " errno: " << errno << endl;
+            exit(10);
+        }
+    }
+
+    proc->setThreadPoolMaxThreadCount(options.services);
+    proc->startThreadPool();
+}
+
+static void client(void)
+{
+    sp<ProcessState> proc(ProcessState::self());
+    sp<IServiceManager> sm = defaultServiceManager();
+
+    // Replies to coroutine requests arrive on the thread pool
+    proc->startThreadPool();
+
+    vector< sp<ICoroAdder> > adders;
+    for (unsigned int n = 0; n < options.services; n++) {
+        sp<IBinder> binder;
+        do {
+            binder = sm->getService(serviceName(n));
+            if (binder != 0) break;
+            cout << "service " << n << " not published, waiting..." << endl;
+            usleep(500000); // 0.5 s
+        } while (true);
+        adders.push_back(interface_cast<ICoroAdder>(binder));
+    }
+
+    // One thread per request
+    vector<pthread_t> threads(options.concurrency);
+    vector<request> requests(options.concurrency);
+    double start = now();
+    for (unsigned int round = 0; round < options.rounds; round++) {
+        for (unsigned int i = 0; i < options.concurrency; i++) {
+            requests[i].adder = adders[i % options.services];
+            requests[i].n = round * options.concurrency + i;
+            if (pthread_create(&threads[i], NULL, blockingRequest, &requests[i]) != 0) {
+                cerr << "pthread_create failed at request " << i
+                    << " errno: " << errno << endl;
+                exit(11);
+            }
+        }
+        for (unsigned int i = 0; i < options.concurrency; i++) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    double blocking = (now() - start) / options.rounds;
+
+    // One coroutine per request
+    sp<Looper> looper;
+    BinderPoolExecutor* poolExecutor = BinderPoolExecutor::get();
+    LooperExecutor* looperExecutor = NULL;
+    if (options.looper) {
+        looper = Looper::prepare(0);
+        looperExecutor = new LooperExecutor(looper);
+    }
+    AwaitExecutor* executor = options.looper
+        ? (AwaitExecutor*) looperExecutor : (AwaitExecutor*) poolExecutor;
+
+    start = now();
+    for (unsigned int round = 0; round < options.rounds; round++) {
+        Round pending(options.concurrency, looper);
+        for (unsigned int i = 0; i < options.concurrency; i++) {
+            spawn(coroutineRequest(adders[i % options.services],
+                                   round * options.concurrency + i,
+                                   executor, &pending));
+        }
+        pending.wait();
+    }
+    double coroutine = (now() - start) / options.rounds;
+    delete looperExecutor;
+
+    cout << "Time per round thread-per-call: " << blocking * 1e3 << " msec"
+        << " coroutine: " << coroutine * 1e3 << " msec" << endl;
+    cout << "Time per request thread-per-call: "
+        << blocking / options.concurrency * 1e6 << " usec"
+        << " coroutine: " << coroutine / options.concurrency * 1e6
+        << " usec" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int rv;
+
+    // Parse command line arguments
+    int opt;
+    while ((opt = getopt(argc, argv, "c:s:n:d:l?")) != -1) {
+        char *chptr; // character pointer for command-line parsing
+
+        switch (opt) {
+        case 'c': // concurrency
+            options.concurrency = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (options.concurrency < 1)) {
+                cerr << "Invalid concurrency specified of: " << optarg << endl;
+                exit(2);
+            }
+            break;
+
+        case 's': // services
+            options.services = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (options.services < 1)) {
+                cerr << "Invalid services specified of: " << optarg << endl;
+                exit(3);
+            }
+            break;
+
+        case 'n': // rounds
+            options.rounds = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (options.rounds < 1)) {
+                cerr << "Invalid rounds specified of: " << optarg << endl;
+                exit(4);
+            }
+            break;
+
+        case 'd': // service time
+            options.work = strtod(optarg, &chptr);
+            if ((*chptr != '\0') || (options.work < 0.0)) {
+                cerr << "Invalid service time specified of: " << optarg << endl;
+                exit(5);
+            }
+            break;
+
+        case 'l': // looper
+            options.looper = true;
+            break;
+
+        case '?':
+        default:
+            cerr << basename(argv[0]) << " [options]" << endl;
+            cerr << "  options:" << endl;
+            cerr << "    -c num - concurrent requests per round" << endl;
+            cerr << "    -s num - service instances" << endl;
+            cerr << "    -n num - rounds per mode" << endl;
+            cerr << "    -d time - service time per request in seconds" << endl;
+            cerr << "    -l - resume coroutines on a Looper" << endl;
+            exit(((optopt == 0) || (optopt == '?')) ? 0 : 6);
+        }
+    }
+
+    // Display selected options
+    cout << "concurrency: " << options.concurrency << endl;
+    cout << "services: " << options.services << endl;
+    cout << "rounds: " << options.rounds << endl;
+    cout << "work: " << options.work << endl;
+    cout << "resume on: " << (options.looper ? "looper" : "binder thread") << endl;
+
+    // Fork client, use this process as server
+    fflush(stdout);
+    switch (pid_t pid = fork()) {
+    case 0: // Child
+        client();
+        return 0;
+
+    default: // Parent
+        server();
+
+        // Wait for all children to end
+        do {
+            int stat;
+            rv = wait(&stat);
+            if ((rv == -1) && (errno == ECHILD)) { break; }
+            if (rv == -1) {
+                cerr << "wait failed, rv: " << rv << " errno: "
+                    << errno << endl;
+                perror(NULL);
+                exit(8);
+            }
+        } while (1);
+        return 0;
+
+    case -1: // Error
+        exit(9);
+    }
+
+    return 0;
+}
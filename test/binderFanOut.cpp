@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Binder fan-out benchmark
+ *
+ * Measures how long a client takes to call each of several services once
+ * and collect all the replies, first with one blocking transact() after
+ * the other and then with BpBinder::transactAsync() issuing every call
+ * before waiting for any reply.  Each service takes a fixed amount of
+ * time per call, sleeping rather than spinning, so the calls can overlap
+ * even with few CPUs.  The services live in a forked server process.
+ *
+ * This benchmark supports the following command-line options:
+ *
+ *   -s num - number of services (default: 4)
+ *   -n num - fan-outs per mode (default: 1000)
+ *   -w time - time each service takes per call, in seconds
+ *             (default: 1e-4)
+ *   -e num - run the services' oneway calls, which carry the async
+ *            requests, on a transaction executor of num workers, 0 for
+ *            one per CPU (default: off, on the binder threads)
+ */
+
+#include <cerrno>
+#include <iostream>
+#include <libgen.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <binder/BpBinder.h>
+#include <binder/IPCThreadState.h>
+#include <binder/ProcessState.h>
+#include <binder/IServiceManager.h>
+#include <utils/String8.h>
+#include "testUtil.h"
+
+using namespace android;
+using namespace std;
+
+struct options {
+    unsigned int services;
+    unsigned int iterations;
+    float        work;      // Service time per call in seconds
+    int          executor;  // Executor workers, -1 for none
+} options = { // Set defaults
+    4,       // Services
+    1000,    // Iterations
+    1e-4,    // Service time
+    -1,      // Executor
+};
+
+class FanOutService : public BBinder
+{
+  public:
+    enum command {
+        WORK = 0x130,
+    };
+
+    virtual status_t onTransact(uint32_t code,
+                                const Parcel& data, Parcel* reply,
+                                uint32_t flags = 0);
+};
+
+static String16 serviceName(unsigned int n)
+{
+    return String16(String8::format("test.binderFanOut.%u", n));
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts2double(&ts);
+}
+
+static void server(void)
+{
+    int rv;
+
+    sp<ProcessState> proc(ProcessState::self());
+    sp<IServiceManager> sm = defaultServiceManager();
+    for (unsigned int n = 0; n < options.services; n++) {
+        sp<FanOutService> service = new FanOutService();
+        service->setAsyncCallsEnabled(true);
+        if ((rv = sm->addService(serviceName(n), service)) != 0) {
+            cerr << "addService " << n << " failed, rv: " << rv
+                << " errno: " << errno << endl;
+            exit(10);
+        }
+    }
+
+    if (options.executor >= 0 &&
+        (rv = proc->enableTransactionExecutor(options.executor)) != 0) {
+        cerr << "enableTransactionExecutor failed, rv: " << rv << endl;
+        exit(14);
+    }
+
+    // Enough threads to run a call to every service at once
+    proc->setThreadPoolMaxThreadCount(options.services);
+    proc->startThreadPool();
+}
+
+static void client(void)
+{
+    sp<ProcessState> proc(ProcessState::self());
+    sp<IServiceManager> sm = defaultServiceManager();
+
+    // Replies to asynchronous calls arrive on the thread pool
+    proc->startThreadPool();
+
+    vector< sp<IBinder> > binders;
+    for (unsigned int n = 0; n < options.services; n++) {
+        sp<IBinder> binder;
+        do {
+            binder = sm->getService(serviceName(n));
+            if (binder != 0) break;
+            cout << "service " << n << " not published, waiting..." << endl;
+            usleep(500000); // 0.5 s
+        } while (true);
+        if (binder->remoteBinder() == NULL) {
+            cerr << "service " << n << " is not remote" << endl;
+            exit(11);
+        }
+        binders.push_back(binder);
+    }
+
+    // One blocking call after the other
+    double start = now();
+    for (unsigned int iter = 0; iter < options.iterations; iter++) {
+        for (unsigned int n = 0; n < options.services; n++) {
+            Parcel send, reply;
+            send.writeInt32(iter);
+            status_t rv = binders[n]->transact(FanOutService::WORK, send, &reply);
+            if (rv != NO_ERROR || reply.readInt32() != (int32_t) iter + 1) {
+                cerr << "transact failed, rv: " << rv << endl;
+                exit(12);
+            }
+        }
+    }
+    double sequential = (now() - start) / options.iterations;
+
+    // Every call issued before waiting for the first reply
+    start = now();
+    for (unsigned int iter = 0; iter < options.iterations; iter++) {
+        vector<Parcel> replies(options.services);
+        vector< future<status_t> > pending;
+        for (unsigned int n = 0; n < options.services; n++) {
+            Parcel send;
+            send.writeInt32(iter);
+            pending.push_back(binders[n]->remoteBinder()->transactAsync(
+                FanOutService::WORK, send, &replies[n]));
+        }
+        for (unsigned int n = 0; n < options.services; n++) {
+            status_t rv = pending[n].get();
+            if (rv != NO_ERROR || replies[n].readInt32() != (int32_t) iter + 1) {
+                cerr << "transactAsync failed, rv: " << rv << endl;
+                exit(13);
+            }
+        }
+    }
+    double async = (now() - start) / options.iterations;
+
+    cout << "Time per fan-out sequential: " << sequential * 1e6 << " usec"
+        << " async: " << async * 1e6 << " usec" << endl;
+}
+
+status_t FanOutService::onTransact(uint32_t code, const Parcel &data,
+                                   Parcel* reply, uint32_t flags) {
+    if (code != WORK) {
+        return BBinder::onTransact(code, data, reply, flags);
+    }
+
+    int32_t val = data.readInt32();
+    struct timespec ts;
+    ts.tv_sec = (time_t) options.work;
+    ts.tv_nsec = (long) ((options.work - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+    reply->writeInt32(val + 1);
+    return NO_ERROR;
+}
+
+int main(int argc, char *argv[])
+{
+    int rv;
+
+    // Parse command line arguments
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:w:e:?")) != -1) {
+        char *chptr; // character pointer for command-line parsing
+
+        switch (opt) {
+        case 's': // services
+            options.services = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (options.services < 1)) {
+                cerr << "Invalid services specified of: " << optarg << endl;
+                exit(2);
+            }
+            break;
+
+        case 'n': // iterations
+            options.iterations = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (options.iterations < 1)) {
+                cerr << "Invalid iterations specified of: " << optarg << endl;
+                exit(3);
+            }
+            break;
+
+        case 'w': // service time
+            options.work = strtod(optarg, &chptr);
+            if ((*chptr != '\0') || (options.work < 0.0)) {
+                cerr << "Invalid service time specified of: " << optarg << endl;
+                exit(4);
+            }
+            break;
+
+        case 'e': // executor workers
+            options.executor = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (options.executor < 0)) {
+                cerr << "Invalid executor workers specified of: " << optarg << endl;
+                exit(6);
+            }
+            break;
+
+        case '?':
+        default:
+            cerr << basename(argv[0]) << " [options]" << endl;
+            cerr << "  options:" << endl;
+            cerr << "    -s num - services" << endl;
+            cerr << "    -n num - fan-outs per mode" << endl;
+            cerr << "    -w time - service time per call in seconds" << endl;
+            cerr << "    -e num - executor workers for oneway calls" << endl;
+            exit(((optopt == 0) || (optopt == '?')) ? 0 : 5);
+        }
+    }
+
+    // Display selected options
+    cout << "services: " << options.services << endl;
+    cout << "iterations: " << options.iterations << endl;
+    cout << "work: " << options.work << endl;
+    cout << "executor: ";
+    if (options.executor < 0) {
+        cout << "off";
+    } else {
+        cout << options.executor;
+    }
+    cout << endl;
+
+    // Fork client, use this process as server
+    fflush(stdout);
+    switch (pid_t pid = fork()) {
+    case 0: // Child
+        client();
+        return 0;
+
+    default: // Parent
+        server();
+
+        // Wait for all children to end
+        do {
+            int stat;
+            rv = wait(&stat);
+            if ((rv == -1) && (errno == ECHILD)) { break; }
+            if (rv == -1) {
+                cerr << "wait failed, rv: " << rv << " errno: "
+                    << errno << endl;
+                perror(NULL);
+                exit(8);
+            }
+        } while (1);
+        return 0;
+
+    case -1: // Error
+        exit(9);
+    }
+
+    return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Parcel allocation benchmark
+ *
+ * Counts the heap allocations made while building and reading back the
+ * parcels of one call, shaped like binderAddInts: a request parcel with
+ * two integers (or a string payload) and a reply parcel with the result.
+ * malloc, calloc and realloc are wrapped to count calls, so the numbers
+ * cover everything libbinder does, not just Parcel's own bookkeeping.  No
+ * binder driver is needed.
+ *
+ * This benchmark supports the following command-line options:
+ *
+ *   -n num - calls to simulate (default: 1000000)
+ *   -p payload - payload size in bytes (default: 0, two integers)
+ */
+
+#include <iostream>
+#include <libgen.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <binder/Parcel.h>
+#include "testUtil.h"
+
+using namespace android;
+using namespace std;
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+static unsigned long allocations;
+
+void* malloc(size_t size)
+{
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+    allocations++;
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+}
+
+struct options {
+    unsigned int iterations;
+    unsigned int payloadSize;
+} options = { // Set defaults
+    1000000,  // Iterations
+    0,        // Payload size
+};
+
+static void call(unsigned int iter, const char *payload)
+{
+    Parcel send, reply;
+
+    if (payload == NULL) {
+        send.writeInt32(iter);
+        send.writeInt32(iter + 3);
+    } else {
+        send.writeInt32(options.payloadSize);
+        send.writeCString(payload);
+    }
+
+    // What the server does with the request
+    send.setDataPosition(0);
+    int32_t val1 = send.readInt32();
+    if (payload == NULL) {
+        reply.writeInt32(val1 + send.readInt32());
+    } else {
+        send.readCString();
+        reply.writeInt32(val1);
+    }
+
+    reply.setDataPosition(0);
+    int32_t expected = (payload == NULL) ? 2 * iter + 3 : options.payloadSize;
+    if (reply.readInt32() != expected) {
+        cerr << "Unexpected result for iteration " << iter << endl;
+        exit(10);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // Parse command line arguments
+    int opt;
+    while ((opt = getopt(argc, argv, "n:p:?")) != -1) {
+        char *chptr; // character pointer for command-line parsing
+
+        switch (opt) {
+        case 'n': // iterations
+            options.iterations = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (options.iterations < 1)) {
+                cerr << "Invalid iterations specified of: " << optarg << endl;
+                exit(2);
+            }
+            break;
+
+        case 'p': // payload size
+            options.payloadSize = strtoul(optarg, &chptr, 10);
+            if (*chptr != '\0') {
+                cerr << "Invalid payload size specified of: " << optarg << endl;
+                exit(3);
+            }
+            break;
+
+        case '?':
+        default:
+            cerr << basename(argv[0]) << " [options]" << endl;
+            cerr << "  options:" << endl;
+            cerr << "    -n num - calls to simulate" << endl;
+            cerr << "    -p payload - payload size in bytes" << endl;
+            exit(((optopt == 0) || (optopt == '?')) ? 0 : 4);
+        }
+    }
+
+    // Display selected options
+    cout << "iterations: " << options.iterations << endl;
+    cout << "payloadSize: " << options.payloadSize << endl;
+
+    char *payload = NULL;
+    if (options.payloadSize > 0) {
+        payload = new char[options.payloadSize + 1];
+        memset(payload, 'a', options.payloadSize);
+        payload[options.payloadSize] = '\0';
+    }
+
+    // Warm up, so one-time setup is not counted
+    call(0, payload);
+
+    struct timespec start, stop;
+    unsigned long before = allocations;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int iter = 0; iter < options.iterations; iter++) {
+        call(iter, payload);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    unsigned long count = allocations - before;
+    double elapsed = ts2double(&stop) - ts2double(&start);
+
+    cout << "allocations per call: "
+        << (double) count / options.iterations << endl;
+    cout << "time per call: " << elapsed / options.iterations * 1e9
+        << " nsec" << endl;
+
+    delete[] payload;
+    return 0;
+}
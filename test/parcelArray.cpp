@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Parcel array benchmark
+ *
+ * Measures the cost of putting an array into a parcel and getting it back
+ * out, once element by element with writeInt32()/readInt32(), once with
+ * writeInt32Array() and a copying readInt32Array(), once reading through
+ * the readInt32ArrayInplace() view, and once for an array of small structs
+ * with writePodArray()/readPodArrayInplace().  No binder driver is needed.
+ *
+ * This benchmark supports the following command-line options:
+ *
+ *   -e num - elements per array (default: 1K and 1M)
+ *   -t num - total elements to process per method, the number of arrays
+ *            is this divided by the array size (default: 50000000)
+ */
+
+#include <iostream>
+#include <libgen.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <binder/Parcel.h>
+#include "testUtil.h"
+
+using namespace android;
+using namespace std;
+
+struct options {
+    size_t elements;  // 0 for 1K and 1M
+    size_t total;
+} options = { // Set defaults
+    0,         // Elements
+    50000000,  // Total elements
+};
+
+struct Sample {
+    float x, y, z;
+    int32_t id;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts2double(&ts);
+}
+
+static void check(int64_t sum, size_t elements)
+{
+    if (sum != (int64_t) elements * (elements - 1) / 2) {
+        cerr << "Unexpected sum " << sum << " for " << elements
+            << " elements" << endl;
+        exit(10);
+    }
+}
+
+static void run(size_t elements)
+{
+    size_t arrays = options.total / elements;
+    if (arrays == 0) arrays = 1;
+
+    int32_t *ints = new int32_t[elements];
+    Sample *samples = new Sample[elements];
+    for (size_t i = 0; i < elements; i++) {
+        ints[i] = i;
+        samples[i].x = samples[i].y = samples[i].z = 0.5f;
+        samples[i].id = i;
+    }
+
+    cout << "elements: " << elements << " arrays: " << arrays << endl;
+
+    double start = now();
+    for (size_t n = 0; n < arrays; n++) {
+        Parcel parcel;
+        parcel.writeInt32(elements);
+        for (size_t i = 0; i < elements; i++) parcel.writeInt32(ints[i]);
+        parcel.setDataPosition(0);
+        int64_t sum = 0;
+        size_t len = parcel.readInt32();
+        for (size_t i = 0; i < len; i++) sum += parcel.readInt32();
+        check(sum, elements);
+    }
+    double perElement = (now() - start) / arrays / elements * 1e9;
+    cout << "  per element: " << perElement << " nsec/element" << endl;
+
+    start = now();
+    for (size_t n = 0; n < arrays; n++) {
+        Parcel parcel;
+        Vector<int32_t> out;
+        parcel.writeInt32Array(elements, ints);
+        parcel.setDataPosition(0);
+        if (parcel.readInt32Array(&out) != NO_ERROR) {
+            cerr << "readInt32Array failed" << endl;
+            exit(11);
+        }
+        int64_t sum = 0;
+        for (size_t i = 0; i < out.size(); i++) sum += out[i];
+        check(sum, elements);
+    }
+    cout << "  bulk copy: " << (now() - start) / arrays / elements * 1e9
+        << " nsec/element" << endl;
+
+    start = now();
+    for (size_t n = 0; n < arrays; n++) {
+        Parcel parcel;
+        size_t len;
+        parcel.writeInt32Array(elements, ints);
+        parcel.setDataPosition(0);
+        const int32_t *view = parcel.readInt32ArrayInplace(&len);
+        if (view == NULL) {
+            cerr << "readInt32ArrayInplace failed" << endl;
+            exit(12);
+        }
+        int64_t sum = 0;
+        for (size_t i = 0; i < len; i++) sum += view[i];
+        check(sum, elements);
+    }
+    cout << "  bulk view: " << (now() - start) / arrays / elements * 1e9
+        << " nsec/element" << endl;
+
+    start = now();
+    for (size_t n = 0; n < arrays; n++) {
+        Parcel parcel;
+        size_t len;
+        parcel.writePodArray(elements, samples);
+        parcel.setDataPosition(0);
+        const Sample *view = parcel.readPodArrayInplace<Sample>(&len);
+        if (view == NULL) {
+            cerr << "readPodArrayInplace failed" << endl;
+            exit(13);
+        }
+        int64_t sum = 0;
+        for (size_t i = 0; i < len; i++) sum += view[i].id;
+        check(sum, elements);
+    }
+    cout << "  struct view: " << (now() - start) / arrays / elements * 1e9
+        << " nsec/element" << endl;
+
+    delete[] ints;
+    delete[] samples;
+}
+
+int main(int argc, char *argv[])
+{
+    // Parse command line arguments
+    int opt;
+    while ((opt = getopt(argc, argv, "e:t:?")) != -1) {
+        char *chptr; // character pointer for command-line parsing
+
+        switch (opt) {
+        case 'e': // elements
+            options.elements = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (options.elements < 1)) {
+                cerr << "Invalid elements specified of: " << optarg << endl;
+                exit(2);
+            }
+            break;
+
+        case 't': // total elements
+            options.total = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (options.total < 1)) {
+                cerr << "Invalid total specified of: " << optarg << endl;
+                exit(3);
+            }
+            break;
+
+        case '?':
+        default:
+            cerr << basename(argv[0]) << " [options]" << endl;
+            cerr << "  options:" << endl;
+            cerr << "    -e num - elements per array" << endl;
+            cerr << "    -t num - total elements per method" << endl;
+            exit(((optopt == 0) || (optopt == '?')) ? 0 : 4);
+        }
+    }
+
+    if (options.elements) {
+        run(options.elements);
+    } else {
+        run(1024);
+        run(1024 * 1024);
+    }
+
+    return 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Proxy lookup benchmark
+ *
+ * Measures how fast several threads can unflatten binder handles with
+ * readStrongBinder(), the way a process that receives many binders in
+ * parallel does.  Each thread reads the same set of handles from its own
+ * parcel over and over; the proxies already exist, so every read is a
+ * lookup in ProcessState's handle table.  No binder driver is needed,
+ * since the handles are made up and no command is ever sent.
+ *
+ * This benchmark supports the following command-line options:
+ *
+ *   -t num - number of threads (default: 1, 2, 4 and 8)
+ *   -n num - reads per thread (default: 1000000)
+ *   -h num - distinct handles (default: 16)
+ */
+
+#include <iostream>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <binder/Parcel.h>
+#include <binder/ProcessState.h>
+#include "testUtil.h"
+
+using namespace android;
+using namespace std;
+
+struct options {
+    unsigned int threads;  // 0 for 1, 2, 4 and 8
+    unsigned int reads;
+    unsigned int handles;
+} options = { // Set defaults
+    0,        // Threads
+    1000000,  // Reads
+    16,       // Handles
+};
+
+struct worker {
+    pthread_t thread;
+    double elapsed;
+};
+
+static void *work(void *arg)
+{
+    worker *w = (worker *) arg;
+    Parcel parcel;
+
+    // Handle 0 is the context manager, which is special cased
+    for (unsigned int h = 1; h <= options.handles; h++) {
+        flat_binder_object obj;
+        memset(&obj, 0, sizeof(obj));
+        obj.type = BINDER_TYPE_HANDLE;
+        obj.handle = h;
+        parcel.writeObject(obj, false);
+    }
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned int i = 0; i < options.reads; ) {
+        parcel.setDataPosition(0);
+        for (unsigned int h = 0; h < options.handles && i < options.reads; h++, i++) {
+            if (parcel.readStrongBinder() == NULL) {
+                cerr << "readStrongBinder failed" << endl;
+                exit(10);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    w->elapsed = ts2double(&stop) - ts2double(&start);
+
+    return NULL;
+}
+
+static void run(unsigned int threads)
+{
+    worker *workers = new worker[threads];
+
+    for (unsigned int i = 0; i < threads; i++) {
+        pthread_create(&workers[i].thread, NULL, work, &workers[i]);
+    }
+    double slowest = 0.0;
+    for (unsigned int i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        if (workers[i].elapsed > slowest) slowest = workers[i].elapsed;
+    }
+
+    double reads = (double) options.reads * threads;
+    cout << "threads " << threads << ":" << endl;
+    cout << "  reads/sec: " << reads / slowest << endl;
+    cout << "  avg latency: " << slowest / options.reads * 1e9
+        << " nsec" << endl;
+
+    delete[] workers;
+}
+
+int main(int argc, char *argv[])
+{
+    // Parse command line arguments
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:h:?")) != -1) {
+        char *chptr; // character pointer for command-line parsing
+        unsigned long val;
+
+        switch (opt) {
+        case 't': // threads
+        case 'n': // reads
+        case 'h': // handles
+            val = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (val < 1)) {
+                cerr << "Invalid value for -" << (char) opt
+                    << " option of: " << optarg << endl;
+                exit(2);
+            }
+            *((opt == 't') ? &options.threads : (opt == 'n')
+                ? &options.reads : &options.handles) = val;
+            break;
+
+        case '?':
+        default:
+            cerr << basename(argv[0]) << " [options]" << endl;
+            cerr << "  options:" << endl;
+            cerr << "    -t num - threads" << endl;
+            cerr << "    -n num - reads per thread" << endl;
+            cerr << "    -h num - distinct handles" << endl;
+            exit(((optopt == 0) || (optopt == '?')) ? 0 : 3);
+        }
+    }
+
+    // Display selected options
+    cout << "reads: " << options.reads << endl;
+    cout << "handles: " << options.handles << endl;
+
+    // Keep a strong reference on every proxy, so the threads only look
+    // them up and never create or destroy one.
+    sp<IBinder> *proxies = new sp<IBinder>[options.handles];
+    for (unsigned int h = 1; h <= options.handles; h++) {
+        proxies[h - 1] = ProcessState::self()->getStrongProxyForHandle(h);
+    }
+
+    if (options.threads) {
+        run(options.threads);
+    } else {
+        for (unsigned int threads = 1; threads <= 8; threads *= 2) {
+            run(threads);
+        }
+    }
+
+    delete[] proxies;
+    return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * Service lookup benchmark
+ *
+ * Registers a large number of services with servicemanager from a forked
+ * server process, then measures from the client how long servicemanager
+ * takes to look a name up, both for registered names in random order and
+ * for names nobody registered, and how long listing every service takes.
+ * Lookups are sent straight to servicemanager, bypassing the lookup cache
+ * of defaultServiceManager(), so each one is a CHECK_SERVICE transaction.
+ *
+ * This benchmark supports the following command-line options:
+ *
+ *   -s num - number of services to register (default: 10000)
+ *   -n num - lookups of each kind (default: 100000)
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <libgen.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <binder/IPCThreadState.h>
+#include <binder/ProcessState.h>
+#include <binder/IServiceManager.h>
+#include <utils/String8.h>
+#include "testUtil.h"
+
+using namespace android;
+using namespace std;
+
+struct options {
+    unsigned int services;
+    unsigned int lookups;
+} options = { // Set defaults
+    10000,   // Services
+    100000,  // Lookups
+};
+
+static String16 serviceName(unsigned int n)
+{
+    return String16(String8::format("test.serviceLookup.%u", n));
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts2double(&ts);
+}
+
+static void server(void)
+{
+    int rv;
+
+    sp<ProcessState> proc(ProcessState::self());
+    sp<IServiceManager> sm = defaultServiceManager();
+    sp<IBinder> service = new BBinder();
+    for (unsigned int n = 0; n < options.services; n++) {
+        if ((rv = sm->addService(serviceName(n), service)) != 0) {
+            cerr << "addService " << n << " failed, rv: " << rv
+                << " errno: " << errno << endl;
+            exit(10);
+        }
+    }
+}
+
+// One CHECK_SERVICE transaction, without the client-side cache
+static sp<IBinder> lookup(const sp<IBinder>& sm, const String16& name)
+{
+    Parcel data, reply;
+    data.writeInterfaceToken(IServiceManager::descriptor);
+    data.writeString16(name);
+    status_t rv = sm->transact(IServiceManager::CHECK_SERVICE_TRANSACTION,
+                               data, &reply);
+    if (rv != NO_ERROR) {
+        cerr << "CHECK_SERVICE failed, rv: " << rv << endl;
+        exit(12);
+    }
+    return reply.readStrongBinder();
+}
+
+static void client(void)
+{
+    sp<ProcessState> proc(ProcessState::self());
+    sp<IServiceManager> sm = defaultServiceManager();
+
+    // Lets servicemanager wake waitForService() below
+    proc->startThreadPool();
+
+    double start = now();
+    if (sm->waitForService(serviceName(options.services - 1)) == NULL) {
+        cerr << "services never registered" << endl;
+        exit(11);
+    }
+    double registration = now() - start;
+
+    vector<String16> names, missing;
+    srand(1);
+    for (unsigned int n = 0; n < options.lookups; n++) {
+        names.push_back(serviceName(rand() % options.services));
+        missing.push_back(serviceName(options.services + rand() % options.services));
+    }
+
+    sp<IBinder> context = proc->getContextObject(NULL);
+    start = now();
+    for (unsigned int n = 0; n < options.lookups; n++) {
+        if (lookup(context, names[n]) == NULL) {
+            cerr << "registered service not found" << endl;
+            exit(13);
+        }
+    }
+    double found = (now() - start) / options.lookups;
+
+    start = now();
+    for (unsigned int n = 0; n < options.lookups; n++) {
+        if (lookup(context, missing[n]) != NULL) {
+            cerr << "unregistered service found" << endl;
+            exit(14);
+        }
+    }
+    double notFound = (now() - start) / options.lookups;
+
+    start = now();
+    Vector<String16> list = sm->listServices();
+    double listing = now() - start;
+    if (list.size() < options.services) {
+        cerr << "listServices returned " << list.size() << " services" << endl;
+        exit(15);
+    }
+
+    cout << "Registration wait: " << registration * 1e3 << " msec" << endl;
+    cout << "Time per lookup found: " << found * 1e6 << " usec"
+        << " not found: " << notFound * 1e6 << " usec" << endl;
+    cout << "Time to list " << list.size() << " services: "
+        << listing * 1e3 << " msec" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int rv;
+
+    // Parse command line arguments
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:?")) != -1) {
+        char *chptr; // character pointer for command-line parsing
+
+        switch (opt) {
+        case 's': // services
+            options.services = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (options.services < 1)) {
+                cerr << "Invalid services specified of: " << optarg << endl;
+                exit(2);
+            }
+            break;
+
+        case 'n': // lookups
+            options.lookups = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (options.lookups < 1)) {
+                cerr << "Invalid lookups specified of: " << optarg << endl;
+                exit(3);
+            }
+            break;
+
+        case '?':
+        default:
+            cerr << basename(argv[0]) << " [options]" << endl;
+            cerr << "  options:" << endl;
+            cerr << "    -s num - services to register" << endl;
+            cerr << "    -n num - lookups of each kind" << endl;
+            exit(((optopt == 0) || (optopt == '?')) ? 0 : 5);
+        }
+    }
+
+    // Display selected options
+    cout << "services: " << options.services << endl;
+    cout << "lookups: " << options.lookups << endl;
+
+    // Fork client, use this process as server
+    fflush(stdout);
+    switch (pid_t pid = fork()) {
+    case 0: // Child
+        client();
+        return 0;
+
+    default: // Parent
+        server();
+
+        // Wait for all children to end
+        do {
+            int stat;
+            rv = wait(&stat);
+            if ((rv == -1) && (errno == ECHILD)) { break; }
+            if (rv == -1) {
+                cerr << "wait failed, rv: " << rv << " errno: "
+                    << errno << endl;
+                perror(NULL);
+                exit(8);
+            }
+        } while (1);
+        return 0;
+
+    case -1: // Error
+        exit(9);
+    }
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * IPCThreadState::self() benchmark
+ *
+ * Measures the cost of finding the calling thread's IPCThreadState, which
+ * every transaction pays several times over: once directly, and again in
+ * the interface token and for each parcel freed back to the driver.  The
+ * rows are a bare self() call and an interface token written and then
+ * enforced, the per-call parcel work of an empty transaction.  No binder
+ * driver is needed.
+ *
+ * This benchmark supports the following command-line options:
+ *
+ *   -n num - iterations per row (default: 10000000)
+ */
+
+#include <iostream>
+#include <libgen.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <binder/IPCThreadState.h>
+#include <binder/Parcel.h>
+#include "testUtil.h"
+
+using namespace android;
+using namespace std;
+
+struct options {
+    unsigned int iterations;
+} options = { // Set defaults
+    10000000, // Iterations
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts2double(&ts);
+}
+
+static void report(const char *name, double elapsed)
+{
+    cout << "  " << name << ": " << elapsed / options.iterations * 1e9
+        << " nsec" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    // Parse command line arguments
+    int opt;
+    while ((opt = getopt(argc, argv, "n:?")) != -1) {
+        char *chptr; // character pointer for command-line parsing
+
+        switch (opt) {
+        case 'n': // iterations
+            options.iterations = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (options.iterations < 1)) {
+                cerr << "Invalid iterations specified of: " << optarg << endl;
+                exit(2);
+            }
+            break;
+
+        case '?':
+        default:
+            cerr << basename(argv[0]) << " [options]" << endl;
+            cerr << "  options:" << endl;
+            cerr << "    -n num - iterations per row" << endl;
+            exit(((optopt == 0) || (optopt == '?')) ? 0 : 3);
+        }
+    }
+
+    // Display selected options
+    cout << "iterations: " << options.iterations << endl;
+
+    // The first call creates the thread's state, keep it out of the timing
+    IPCThreadState::self();
+
+    double start = now();
+    for (unsigned int i = 0; i < options.iterations; i++) {
+        IPCThreadState::self()->setStrictModePolicy(i);
+    }
+    report("self()", now() - start);
+
+    const String16 descriptor("android.test.IThreadStateSelf");
+    Parcel parcel;
+    start = now();
+    for (unsigned int i = 0; i < options.iterations; i++) {
+        parcel.setDataSize(0);
+        parcel.writeInterfaceToken(descriptor);
+        parcel.setDataPosition(0);
+        if (!parcel.enforceInterface(descriptor)) {
+            cerr << "enforceInterface failed" << endl;
+            exit(10);
+        }
+    }
+    report("interface token", now() - start);
+
+    return 0;
+}
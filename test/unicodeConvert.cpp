@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+/*
+ * String conversion benchmark
+ *
+ * Measures the string work every call does around its interface token:
+ * building a String16 from UTF-8, converting a String16 back to a String8,
+ * comparing two equal String16s, writing and reading a String16 through a
+ * Parcel, and a writeInterfaceToken()/enforceInterface() pair, with the
+ * name sent as a string and as a compact id.  The strings are
+ * service and interface names as found on a device, plus a long one and
+ * one that is not ASCII.  No binder driver is needed.
+ *
+ * This benchmark supports the following command-line options:
+ *
+ *   -n num - conversions per string and operation (default: 1000000)
+ */
+
+#include <iostream>
+#include <libgen.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <binder/Parcel.h>
+#include <utils/String16.h>
+#include <utils/String8.h>
+#include "testUtil.h"
+
+using namespace android;
+using namespace std;
+
+struct options {
+    unsigned int iterations;
+} options = { // Set defaults
+    1000000,  // Iterations
+};
+
+static const char *names[] = {
+    "media.audio_policy",
+    "android.os.IServiceManager",
+    "android.hardware.ICameraService",
+    "com.android.internal.telephony.ITelephonyRegistry",
+    "android.content.pm.IPackageManager/com.android.providers.downloads"
+        ".DownloadProvider/com.android.providers.media.MediaProvider",
+    "android.media.IAudioService/\xc3\xa9t\xc3\xa9/\xe6\x97\xa5\xe6\x9c\xac",
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts2double(&ts);
+}
+
+static void run(const char *name)
+{
+    size_t len = strlen(name);
+    String16 ref(name);
+    String16 copy(ref.string(), ref.size());  // Equal but not shared
+    size_t sum = 0;
+
+    cout << name << " (" << len << " bytes):" << endl;
+
+    double start = now();
+    for (unsigned int i = 0; i < options.iterations; i++) {
+        String16 s(name, len);
+        sum += s.size();
+    }
+    cout << "  utf8 to utf16: "
+        << (now() - start) / options.iterations * 1e9 << " nsec" << endl;
+
+    start = now();
+    for (unsigned int i = 0; i < options.iterations; i++) {
+        String8 s(ref);
+        sum += s.size();
+    }
+    cout << "  utf16 to utf8: "
+        << (now() - start) / options.iterations * 1e9 << " nsec" << endl;
+
+    start = now();
+    for (unsigned int i = 0; i < options.iterations; i++) {
+        sum += (ref == copy);
+    }
+    cout << "  compare: "
+        << (now() - start) / options.iterations * 1e9 << " nsec" << endl;
+
+    start = now();
+    for (unsigned int i = 0; i < options.iterations; i++) {
+        Parcel parcel;
+        parcel.writeString16(ref);
+        parcel.setDataPosition(0);
+        sum += (parcel.readString16() == ref);
+    }
+    cout << "  parcel round trip: "
+        << (now() - start) / options.iterations * 1e9 << " nsec" << endl;
+
+    for (int compact = 0; compact <= 1; compact++) {
+        start = now();
+        for (unsigned int i = 0; i < options.iterations; i++) {
+            Parcel parcel;
+            if (compact) {
+                parcel.writeCompactInterfaceToken(ref);
+            } else {
+                parcel.writeInterfaceToken(ref);
+            }
+            parcel.setDataPosition(0);
+            sum += parcel.enforceInterface(ref);
+        }
+        cout << (compact ? "  compact token: " : "  interface token: ")
+            << (now() - start) / options.iterations * 1e9 << " nsec" << endl;
+    }
+
+    // Each iteration of the six loops adds the same amount
+    size_t expected = (size_t) options.iterations
+        * (ref.size() + String8(ref).size() + 4);
+    if (sum != expected) {
+        cerr << "Unexpected result for " << name << endl;
+        exit(10);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    // Parse command line arguments
+    int opt;
+    while ((opt = getopt(argc, argv, "n:?")) != -1) {
+        char *chptr; // character pointer for command-line parsing
+
+        switch (opt) {
+        case 'n': // iterations
+            options.iterations = strtoul(optarg, &chptr, 10);
+            if ((*chptr != '\0') || (options.iterations < 1)) {
+                cerr << "Invalid iterations specified of: " << optarg << endl;
+                exit(2);
+            }
+            break;
+
+        case '?':
+        default:
+            cerr << basename(argv[0]) << " [options]" << endl;
+            cerr << "  options:" << endl;
+            cerr << "    -n num - conversions per string and operation" << endl;
+            exit(((optopt == 0) || (optopt == '?')) ? 0 : 3);
+        }
+    }
+
+    // Display selected options
+    cout << "iterations: " << options.iterations << endl;
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        run(names[i]);
+    }
+
+    return 0;
+}